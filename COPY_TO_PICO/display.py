@@ -1,12 +1,13 @@
 from machine import Pin, WDT
-from utime import sleep_us, sleep, ticks_us, ticks_diff
-from rp2 import StateMachine, asm_pio, PIO
+from utime import sleep_us, sleep, sleep_ms, ticks_us, ticks_ms, ticks_add, ticks_diff
 from micropython import const
 import _thread
 import os
 import gc
-import rp2
 import machine
+import hub75
+import tracebuf
+import framecache
 
 enable_pin = Pin(5, Pin.OUT, value=1)
 
@@ -14,9 +15,42 @@ enable_pin = Pin(5, Pin.OUT, value=1)
 MATRIX_SIZE_X = 64
 MATRIX_SIZE_Y = 32
 
-#Time before cycling to next image, in seconds
+#Each stored pixel is shown as a PIXEL_SCALE x PIXEL_SCALE block; must match PIXEL_SCALE in 'config.ini'
+PIXEL_SCALE = 1
+
+#Order rows and planes are shown in: 'sequential', 'interleaved' or 'row_planes' (see 'lib/hub75.py'); must match SCAN_ORDER in 'config.ini'
+SCAN_ORDER = 'sequential'
+
+#Skip shifting rows that light nothing in a color plane, so frames with dark areas refresh faster (see 'lib/hub75.py'); must match SKIP_DARK_ROWS in 'config.ini'
+SKIP_DARK_ROWS = False
+
+#Show frames sent live by a companion board over the parallel bus (see 'lib/frame_rx.py', and 'frame_sender.py' for how the sender adapts to the link) instead of the frames directory; not with SKIP_DARK_ROWS
+LIVE_INPUT = False
+
+#Show each live frame as soon as its first planes arrive, refining it as the rest do, for a sender that encodes frames with 'progressive_planes' in 'frame_compiler.py' (see 'lib/frame_rx.py')
+LIVE_PROGRESSIVE = False
+
+#Time between image changes, in seconds; the schedule is kept however long reading, transitions and memory clearing take
 CYCLE_TIME = 5
 
+#How one image changes to the next: 'cut', 'crossfade', 'fade', 'wipe', 'slide' or 'dissolve' (see 'lib/transition.py'), over TRANSITION_TIME seconds in TRANSITION_STEPS steps; PIO_FREQ has to refresh the panel faster than the steps go. Not with SKIP_DARK_ROWS or DIM_PLANES
+TRANSITION = 'cut'
+TRANSITION_TIME = 1
+TRANSITION_STEPS = 15
+
+#Run the panel self-test (see 'lib/selftest.py') before showing frames; it also runs, over and over, when there are no frames
+SELF_TEST = False
+
+#Record timestamped events from both cores in a ring buffer of TRACE_EVENTS per core (see 'lib/tracebuf.py'); send 'd' over the serial port to print it, and 'trace_export.py' turns the output into a Chrome/Perfetto trace
+TRACE = False
+TRACE_EVENTS = const(512)
+
+#Keep up to FRAME_CACHE_BYTES of frames and their row lists in RAM, least recently shown dropped first (see 'lib/framecache.py'), so a looping playlist is only read from storage once; it should hold the whole playlist, 0 reads every frame every time
+FRAME_CACHE_BYTES = const(96_000)
+
+#Compose the panel from the zones of a layout compiled by 'zone_compiler.py' (see 'zones.ini' and 'lib/zones.py'), each showing its own images at its own interval, instead of cycling through the frames directory; '' for none. Not with SKIP_DARK_ROWS or LIVE_INPUT
+ZONE_LAYOUT = ''
+
 #The number of data selection addresses on your LED Matrix
 MATRIX_ADDRESS_COUNT = const(16)
 
@@ -25,86 +59,236 @@ MEM_CLEAR_THRESH = const(50_000)
 PIO_FREQ = const(20_000)
 MACHINE_FREQ = const(250_000_000)
 
-''' Calculating correct values to feed into PIO program given dimensions '''
+#Clock the panel from MACHINE_FREQ instead of PIO_FREQ, as fast as the shift timing below allows (see 'lib/hub75.py'); rows then go out as fast as the feeder sends them
+HIGH_SPEED_SHIFT = False
 
-rp2._pio_funcs["max_address_val"] = MATRIX_ADDRESS_COUNT - 1
+#Shortest times, in ns, the panel needs with HIGH_SPEED_SHIFT: color data set up before the clock rises, the clock high, the row address settled before LAT rises, and LAT high
+SHIFT_SETUP_NS = const(25)
+SHIFT_CLOCK_HIGH_NS = const(25)
+ADDRESS_SETUP_NS = const(100)
+LATCH_NS = const(50)
+
+#Lower bits of color shown in 1 to 4 extra planes with OE cut to 1/2, 1/4, ... of a plane's time, for up to 8 bits per color from 19 row slots (see 'lib/hub75.py'); needs HIGH_SPEED_SHIFT and must match DIM_PLANES in 'config.ini'. Not with SKIP_DARK_ROWS, SCAN_ORDER = 'row_planes' or LIVE_INPUT
+DIM_PLANES = 0
 
 gc.disable()
 
+if TRACE:
+    tracebuf.enable(TRACE_EVENTS)
+
 machine.freq(MACHINE_FREQ)
 
 crash_wdt = WDT(timeout=10000)
 
-frames_paths = [('/frames/' + plainpath) for plainpath in os.listdir('frames')]
+frames_paths = [('/frames/' + plainpath) for plainpath in os.listdir('frames')] if 'frames' in os.listdir() else []
 
 frame_buffer_lock = _thread.allocate_lock()
 
 feed_frames = True
 
+def feed_watchdog():
+    crash_wdt.feed()
+    tracebuf.record(tracebuf.WDT_FEED)
+
+def collect_garbage():
+    tracebuf.record(tracebuf.GC_BEGIN, gc.mem_free() // 1024)
+    gc.collect()
+    tracebuf.record(tracebuf.GC_END, gc.mem_free() // 1024)
+
 def frames_feeder():
     global frame_buffer
+    global frame_rows
     global feed_frames
+    shown_buffer = shown_rows = None
     while feed_frames:
         enable_pin.value(0)
-        with frame_buffer_lock:
-            led_data_sm.put(frame_buffer)
-
-@asm_pio(out_init=(rp2.PIO.OUT_LOW,) * 6, sideset_init=rp2.PIO.OUT_LOW, 
-         set_init=(rp2.PIO.OUT_HIGH, ) * 2, out_shiftdir=PIO.SHIFT_RIGHT)
-def led_data():
-    set(x, 31)
-    in_(x, 6)
-    in_(x, 1)
-    wrap_target()
-    mov(x, isr)
-    label("Byte Counter")
-    pull().side(0)
-    out(pins, 6).side(1)
-    jmp(x_dec, "Byte Counter")
-    irq(block, 4)
-    irq(block, 5)
-    wrap()
-    
-
-@asm_pio(out_init=(rp2.PIO.OUT_LOW,) * 4, set_init=(rp2.PIO.OUT_HIGH, ) * 1,
-         out_shiftdir=PIO.SHIFT_RIGHT)
-def address_counter():
-    max_address_val = MATRIX_ADDRESS_COUNT - 1
-    set(x, max_address_val)
-    label("Address Decrement")
-    wait(1, irq, 4)
-    mov(pins, x)
-    set(pins, 1)
-    set(pins, 0)
-    irq(clear, 5)
-    jmp(x_dec, "Address Decrement")
-
-led_data_sm = StateMachine(0, led_data, freq=PIO_FREQ, out_base=Pin(10), sideset_base=Pin(9))
-
-address_counter_sm = StateMachine(1, address_counter, freq=PIO_FREQ, out_base=Pin(0), set_base=Pin(4))
+        if not frame_buffer_lock.acquire(0):
+            tracebuf.record(tracebuf.STALL_BEGIN)
+            frame_buffer_lock.acquire()
+            tracebuf.record(tracebuf.STALL_END)
+        if frame_buffer is not shown_buffer or frame_rows is not shown_rows:
+            shown_buffer, shown_rows = frame_buffer, frame_rows
+            tracebuf.record(tracebuf.SWAP)
+        try:
+            hub75.put_frame(led_data_sm, frame_buffer, frame_rows, plane_words_sm)
+        finally:
+            frame_buffer_lock.release()
+
+shift_timing = hub75.shift_timing(MACHINE_FREQ, SHIFT_SETUP_NS, SHIFT_CLOCK_HIGH_NS, ADDRESS_SETUP_NS, LATCH_NS) if HIGH_SPEED_SHIFT else None
+refresh_freq = shift_timing.freq if HIGH_SPEED_SHIFT else PIO_FREQ
+if HIGH_SPEED_SHIFT:
+    print("high speed shift: %d Hz state machines, %d Hz column clock" % (shift_timing.freq, shift_timing.clock_hz(PIXEL_SCALE)))
+
+led_data_sm, address_counter_sm = hub75.init_state_machines(refresh_freq, MATRIX_SIZE_X, MATRIX_ADDRESS_COUNT, PIXEL_SCALE, SCAN_ORDER, SKIP_DARK_ROWS, timing=shift_timing, dim_planes=DIM_PLANES)
+on_cycles = hub75.plane_on_cycles(MATRIX_SIZE_X, PIXEL_SCALE, shift_timing, DIM_PLANES) if DIM_PLANES else None
+
+#address_counter takes a word from the feeder ahead of each group of rows when skipping dark rows or with dim planes
+plane_words_sm = address_counter_sm if SKIP_DARK_ROWS or DIM_PLANES else None
 
 address_counter_sm.active(1)
 led_data_sm.active(1)
 
-with open(frames_paths[0], 'rb') as frame_data:
-        frame_buffer_temp = frame_data.read()
+if SELF_TEST or not (frames_paths or LIVE_INPUT or ZONE_LAYOUT):
+    import selftest
+    enable_pin.value(0)
+    selftest.run(led_data_sm, MATRIX_SIZE_X, MATRIX_SIZE_Y, refresh_freq, PIXEL_SCALE, SCAN_ORDER, feed=feed_watchdog, address_counter_sm=plane_words_sm, timing=shift_timing, on_cycles=on_cycles)
+    while not (frames_paths or LIVE_INPUT or ZONE_LAYOUT):
+        selftest.run(led_data_sm, MATRIX_SIZE_X, MATRIX_SIZE_Y, refresh_freq, PIXEL_SCALE, SCAN_ORDER, feed=feed_watchdog, address_counter_sm=plane_words_sm, timing=shift_timing, on_cycles=on_cycles)
+
+if LIVE_INPUT:
+    import frame_rx
+    if SKIP_DARK_ROWS or DIM_PLANES:
+        raise ValueError("LIVE_INPUT frames carry no dark bits or dim planes, set SKIP_DARK_ROWS = False and DIM_PLANES = 0")
+    receiver = frame_rx.FrameReceiver(hub75.PLANE_COUNT * (MATRIX_ADDRESS_COUNT // PIXEL_SCALE) * (MATRIX_SIZE_X // PIXEL_SCALE), ack_pin=26, progressive=LIVE_PROGRESSIVE)
+
+    # The receiver's buffers never move, so their row lists are only made again when the sender changes the number of planes it sends
+    def live_rows(planes):
+        return {id(buffer): hub75.frame_rows(buffer, MATRIX_SIZE_X, MATRIX_ADDRESS_COUNT, PIXEL_SCALE, SCAN_ORDER, planes=planes) for buffer in receiver.buffers}
 
-frame_buffer = frame_buffer_temp
+    def live_feeder():
+        planes = hub75.PLANE_COUNT
+        rows = live_rows(planes)
+        shown = None
+        while True:
+            frame = receiver.latest()
+            if receiver.planes != planes:
+                planes = receiver.planes
+                rows = live_rows(planes)
+            if frame is not shown:
+                shown = frame
+                tracebuf.record(tracebuf.SWAP, planes)
+            hub75.put_frame(led_data_sm, frame, rows[id(frame)])
+
+    enable_pin.value(0)
+    _thread.start_new_thread(live_feeder, ())
+    while True:
+        sleep(CYCLE_TIME)
+        print("live input: %d frames received, %d dropped, %d planes" % (receiver.frames, receiver.dropped, receiver.planes))
+        if tracebuf.requested():
+            tracebuf.dump()
+        if gc.mem_free() < MEM_CLEAR_THRESH:
+            collect_garbage()
+        feed_watchdog()
+
+frame_cache = framecache.FrameCache(FRAME_CACHE_BYTES)
+
+def load_frame(path):
+    cached = frame_cache.get(path)
+    if cached is not None:
+        tracebuf.record(tracebuf.CACHE_HIT)
+        return cached
+    tracebuf.record(tracebuf.READ_BEGIN)
+    with open(path, 'rb') as frame_data:
+        frame = frame_data.read()
+    tracebuf.record(tracebuf.READ_END)
+    rows = hub75.frame_rows(frame, MATRIX_SIZE_X, MATRIX_ADDRESS_COUNT, PIXEL_SCALE, SCAN_ORDER, skip_dark_rows=SKIP_DARK_ROWS, on_cycles=on_cycles)
+    frame_cache.put(path, frame, rows)
+    return frame, rows
+
+def clear_memory():
+    global feed_frames
+    feed_frames = False
+    with frame_buffer_lock:
+        enable_pin.value(1)
+        #With HIGH_SPEED_SHIFT, OE belongs to address_counter
+        if HIGH_SPEED_SHIFT:
+            address_counter_sm.exec("set(pins, 2)")
+        collect_garbage()
+        # The cache only uses spare memory: when that runs short it is given back
+        if gc.mem_free() < MEM_CLEAR_THRESH:
+            frame_cache.clear()
+            collect_garbage()
+        feed_frames = True
+        _thread.start_new_thread(frames_feeder, ())
+
+if ZONE_LAYOUT:
+    import zones
+    if SKIP_DARK_ROWS or LIVE_INPUT:
+        raise ValueError("zones leave dark rows and live input as they were, set SKIP_DARK_ROWS = False and LIVE_INPUT = False")
+    layout = zones.Layout(ZONE_LAYOUT)
+
+    # Zones are written into the buffer not on show, which is swapped in and then given the same patches; both keep the row lists made for them here
+    zone_buffers = [bytearray(layout.frame_size) for _ in range(2)]
+    zone_rows = [hub75.frame_rows(buffer, MATRIX_SIZE_X, MATRIX_ADDRESS_COUNT, PIXEL_SCALE, SCAN_ORDER, on_cycles=on_cycles) for buffer in zone_buffers]
+    frame_buffer, frame_rows = zone_buffers[0], zone_rows[0]
+    back = 1
+
+    def load_patch(path):
+        cached = frame_cache.get(path)
+        if cached is not None:
+            tracebuf.record(tracebuf.CACHE_HIT)
+            return cached[0]
+        tracebuf.record(tracebuf.READ_BEGIN)
+        with open(path, 'rb') as patch_data:
+            patch = patch_data.read()
+        tracebuf.record(tracebuf.READ_END)
+        frame_cache.put(path, patch, None)
+        return patch
+
+    _thread.start_new_thread(frames_feeder, ())
+
+    updates = bytes_written = 0
+    next_report = ticks_add(ticks_ms(), CYCLE_TIME * 1000)
+    while True:
+        now = ticks_ms()
+        patches = [(zone, load_patch(zone.advance(now))) for zone in layout.zones if zone.due(now)]
+        if patches:
+            for zone, patch in patches:
+                zone.apply(zone_buffers[back], patch)
+            with frame_buffer_lock:
+                frame_buffer, frame_rows = zone_buffers[back], zone_rows[back]
+            tracebuf.record(tracebuf.PUBLISH, len(patches))
+            back ^= 1
+            for zone, patch in patches:
+                zone.apply(zone_buffers[back], patch)
+                bytes_written += 2 * len(patch)
+            updates += len(patches)
+            patches = None
+        feed_watchdog()
+        if tracebuf.requested():
+            tracebuf.dump()
+        if gc.mem_free() < MEM_CLEAR_THRESH:
+            clear_memory()
+        if ticks_diff(ticks_ms(), next_report) >= 0:
+            next_report = ticks_add(next_report, CYCLE_TIME * 1000)
+            print("zones: %d updates, %d bytes written, frame cache: %d hits, %d misses, %d KiB not read" % (updates, bytes_written, frame_cache.hits, frame_cache.misses, frame_cache.kb_saved))
+        sleep_ms(layout.wait_ms(ticks_ms(), CYCLE_TIME * 1000))
+
+frame_buffer, frame_rows = load_frame(frames_paths[0])
 
 _thread.start_new_thread(frames_feeder, ())
 
-for _ in range(10000):
+frame_transition = None
+if TRANSITION != 'cut' and not (SKIP_DARK_ROWS or DIM_PLANES):
+    import transition
+    frame_transition = transition.Transition(TRANSITION, MATRIX_SIZE_X, MATRIX_ADDRESS_COUNT, PIXEL_SCALE, SCAN_ORDER)
+
+next_change = ticks_ms()
+while True:
     for path in frames_paths:
-        sleep(CYCLE_TIME)
-        with open(path, 'rb') as frame_data:
-            frame_buffer_temp = frame_data.read()
+        next_change = ticks_add(next_change, CYCLE_TIME * 1000)
+        wait = ticks_diff(next_change, ticks_ms())
+        if wait < 0:
+            next_change = ticks_ms()
+        else:
+            sleep_ms(wait)
+        feed_watchdog()
+        if tracebuf.requested():
+            tracebuf.dump()
+        frame_buffer_temp, frame_rows_temp = load_frame(path)
+        if frame_transition is not None:
+            frame_transition.begin(frame_buffer, frame_buffer_temp)
+            for step in range(1, TRANSITION_STEPS):
+                frame_rows_step = frame_transition.rows(step, TRANSITION_STEPS)
+                with frame_buffer_lock:
+                    frame_rows = frame_rows_step
+                tracebuf.record(tracebuf.PUBLISH, step)
+                sleep(TRANSITION_TIME / TRANSITION_STEPS)
+                feed_watchdog()
         with frame_buffer_lock:
             frame_buffer = frame_buffer_temp
+            frame_rows = frame_rows_temp
+        tracebuf.record(tracebuf.PUBLISH, TRANSITION_STEPS)
         if gc.mem_free() < MEM_CLEAR_THRESH:
-            feed_frames = False
-            with frame_buffer_lock:
-                enable_pin.value(1)
-                gc.collect()
-                feed_frames = True
-                _thread.start_new_thread(frames_feeder, ())
-        crash_wdt.feed()
\ No newline at end of file
+            clear_memory()
+    print("frame cache: %d hits, %d misses, %d KiB not read, %d of %d bytes held" % (frame_cache.hits, frame_cache.misses, frame_cache.kb_saved, frame_cache.used, frame_cache.budget))
\ No newline at end of file
@@ -0,0 +1,200 @@
+"""
+Palette expansion: turns an indexed image (one byte per pixel, up to 256
+colors) into a frame of HUB-75 plane bytes on the Pico, in the layout
+png_to_frame.py writes, so images can be stored or sent at a byte per pixel
+and expanded on the device.
+
+Every palette color is looked up once, when the Expander is made, into two
+tables of PLANE_COUNT x 256 bytes: a color's B, G, R bits in each plane, in
+bits 0-2 and in bits 3-5.  Each byte of the frame is then one lookup in each
+table, for the pixel pair it shows, ORed together; what is left per byte is
+walking the two table indices along the planes.
+
+On the RP2040 that walk can be done by interpolator 0 of the core it runs
+on: each lane holds an address in one table and adds 256 (one plane) to it
+on every POP, so the kernel reads two ready made table addresses per byte
+instead of working them out.  Both kernels give the same frames.  Whether
+the interpolator wins depends on the code viper makes of each loop, so no
+figure is built in: on rp2 the first expand() times both kernels on its
+own frame and the Expander keeps the faster (use_interp says which, and
+True or False skips the timing).  benchmark() prints both on the board:
+
+    import expand
+    expander = expand.Expander(64, 32, palette)      # [(r, g, b), ...], 8-bit
+    expander.expand(frame, indices)                  # 15360 and 2048 bytes
+    expand.benchmark()                               # both kernels, on the Pico
+
+RGB data at 3-3-2 bits per pixel is the same thing with rgb332_palette().
+
+Nothing else in MicroPython uses the interpolators; a program that does
+should not expand on the same core.
+"""
+
+import sys
+import uctypes
+from utime import ticks_us, ticks_diff
+from micropython import const
+import micropython
+
+PLANE_COUNT = const(15)
+TABLE_STRIDE = 256
+
+# INTERP0 on SIO, as 32-bit register indices from ACCUM0
+_INTERP0 = const(0xD0000080)
+_ACCUM0 = const(0)
+_ACCUM1 = const(1)
+_BASE0 = const(2)
+_BASE1 = const(3)
+_POP_LANE0 = const(5)
+_PEEK_LANE1 = const(9)
+_CTRL_LANE0 = const(11)
+_CTRL_LANE1 = const(12)
+# Lane result = BASE + the whole accumulator (shift 0, mask bits 0-31)
+_CTRL_ADD = const(31 << 10)
+
+
+def channel_planes(value, modulation="high_freq"):
+    # Planes an 8-bit channel value is lit in, as frame_compiler.encode does
+    level = value // 15
+    planes = 0
+    if modulation == "basic":
+        for i in range(PLANE_COUNT):
+            if level > i:
+                planes |= 1 << i
+        return planes
+    for i in range(level):
+        planes |= 1 << int(PLANE_COUNT / level * i)
+    return planes
+
+
+def rgb332_palette():
+    # Index rrrgggbb, each channel spread over 0-255
+    return [((i >> 5) * 255 // 7, ((i >> 2) & 7) * 255 // 7, (i & 3) * 255 // 3) for i in range(256)]
+
+
+def palette_tables(palette, modulation="high_freq"):
+    # low[p * 256 + i] holds color i's B, G, R bits in plane p as bits 0-2,
+    # high the same as bits 3-5
+    low = bytearray(PLANE_COUNT * TABLE_STRIDE)
+    high = bytearray(PLANE_COUNT * TABLE_STRIDE)
+    for i, (red, green, blue) in enumerate(palette):
+        planes = (channel_planes(blue, modulation), channel_planes(green, modulation), channel_planes(red, modulation))
+        for p in range(PLANE_COUNT):
+            bits = 0
+            for k in range(3):
+                bits |= ((planes[k] >> p) & 1) << k
+            low[p * TABLE_STRIDE + i] = bits
+            high[p * TABLE_STRIDE + i] = bits << 3
+    return low, high
+
+
+@micropython.viper
+def _expand_soft(frame, indices, low, high, width: int, half: int):
+    out = ptr8(frame)
+    image = ptr8(indices)
+    low_table = ptr8(low)
+    high_table = ptr8(high)
+    plane_bytes = half * width
+    for r in range(half):
+        # Bits 0-2 come from image row 'height - 1 - r', bits 3-5 from 'half - 1 - r'
+        low_row = (2 * half - 1 - r) * width
+        high_row = (half - 1 - r) * width
+        for x in range(width):
+            a = int(image[low_row + x])
+            b = int(image[high_row + x])
+            o = r * width + x
+            for p in range(PLANE_COUNT):
+                out[o] = low_table[a] | high_table[b]
+                a += 256
+                b += 256
+                o += plane_bytes
+
+
+@micropython.viper
+def _expand_interp(frame, indices, low: int, high: int, width: int, half: int):
+    # low and high are the tables' addresses: each lane walks an address,
+    # so a POP gives a byte's table entry ready to read.  The addresses sit
+    # in the accumulators, not BASE0/BASE1, as a POP writes each lane's
+    # result, base and all, back to its accumulator; the base is the stride
+    out = ptr8(frame)
+    image = ptr8(indices)
+    interp = ptr32(_INTERP0)
+    interp[_CTRL_LANE0] = _CTRL_ADD
+    interp[_CTRL_LANE1] = _CTRL_ADD
+    interp[_BASE0] = 256
+    interp[_BASE1] = 256
+    # One plane back, so the first POP lands on plane 0
+    low -= 256
+    high -= 256
+    plane_bytes = half * width
+    for r in range(half):
+        low_row = (2 * half - 1 - r) * width
+        high_row = (half - 1 - r) * width
+        for x in range(width):
+            interp[_ACCUM0] = low + int(image[low_row + x])
+            interp[_ACCUM1] = high + int(image[high_row + x])
+            o = r * width + x
+            for p in range(PLANE_COUNT):
+                # PEEK lane 1 before the POP, which moves both lanes on
+                b = ptr8(interp[_PEEK_LANE1])
+                a = ptr8(interp[_POP_LANE0])
+                out[o] = a[0] | b[0]
+                o += plane_bytes
+
+
+class Expander:
+    def __init__(self, width, height, palette, modulation="high_freq", use_interp=None):
+        if len(palette) > TABLE_STRIDE:
+            raise ValueError("a palette has at most %d colors, not %d" % (TABLE_STRIDE, len(palette)))
+        self.width = width
+        self.height = height
+        self.frame_size = PLANE_COUNT * (height // 2) * width
+        self.low, self.high = palette_tables(palette, modulation)
+        if use_interp is None and sys.platform != "rp2":
+            use_interp = False
+        self.use_interp = use_interp
+
+    def expand(self, frame, indices):
+        if len(frame) < self.frame_size or len(indices) < self.width * self.height:
+            raise ValueError("frame needs %d bytes and indices %d" % (self.frame_size, self.width * self.height))
+        if self.use_interp is None:
+            # Both write the same frame, so the faster one is kept for good
+            interp = self._timed(True, frame, indices)
+            self.use_interp = interp < self._timed(False, frame, indices)
+        elif self.use_interp:
+            # The tables are never moved, so their addresses hold for the call
+            _expand_interp(frame, indices, uctypes.addressof(self.low), uctypes.addressof(self.high), self.width,
+                           self.height // 2)
+        else:
+            _expand_soft(frame, indices, self.low, self.high, self.width, self.height // 2)
+        return frame
+
+    def _timed(self, use_interp, frame, indices):
+        self.use_interp = use_interp
+        start = ticks_us()
+        self.expand(frame, indices)
+        return ticks_diff(ticks_us(), start)
+
+
+def benchmark(width=64, height=32, repeats=10):
+    # Frames per second from each kernel on this board, expanding a 256
+    # color palette
+    palette = [((i * 37) & 255, (i * 91) & 255, (i * 53) & 255) for i in range(256)]
+    indices = bytearray((i * 7) & 255 for i in range(width * height))
+    kernels = [("software", False)]
+    if sys.platform == "rp2":
+        kernels.append(("interpolator", True))
+    results = {}
+    for name, use_interp in kernels:
+        expander = Expander(width, height, palette, use_interp=use_interp)
+        frame = bytearray(expander.frame_size)
+        start = ticks_us()
+        for _ in range(repeats):
+            expander.expand(frame, indices)
+        elapsed = max(1, ticks_diff(ticks_us(), start))
+        results[name] = elapsed / repeats
+        print("expand %s: %.1f ms per %dx%d frame, %.1f fps" % (name, elapsed / repeats / 1000, width, height,
+                                                                repeats * 1_000_000 / elapsed))
+    if len(results) > 1:
+        print("interpolator speed-up: %.2fx" % (results["software"] / results["interpolator"]))
+    return results
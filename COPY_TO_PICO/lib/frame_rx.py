@@ -0,0 +1,214 @@
+"""
+Parallel frame receiver, for frames sent live by a companion board (a second
+Pico, or a Raspberry Pi capturing HDMI or VGA).
+
+The bus is six data lines on consecutive pins, one per bit of a frame byte
+(bits 6 and 7 are always 0), a pixel clock PCLK and a FRAME line.  The sender
+raises FRAME, clocks out one frame's bytes in the layout png_to_frame.py
+writes, each valid from before PCLK rises until after it falls, lowering
+FRAME along with the last byte, and leaves at least MIN_BLANKING_US before
+the next frame.  frame_sender.py generates the same signals on the PC.
+
+A frame may carry fewer planes than the panel shows, to fit a slower link
+(see frame_sender.py): 5, 3 or 1 planes, any number that divides the
+planes of a full frame, each shown in turn in place of the full frame's.
+Frames of fewer planes are always in the sequential layout.
+
+frame_rx packs every byte into the RX FIFO, four to a word, and raises its
+IRQ after the byte sent with FRAME low; a DMA channel moves the words
+straight into the back buffer, so the CPU does nothing per byte.  At the IRQ
+the DMA count gives the frame's length: a whole number of planes makes the
+back buffer the ready frame, and the DMA is re-armed on the old ready
+buffer while the sender is blanking.  The refresh calls latest() at the
+start of each of its own frames, which swaps in the newest ready frame; the
+buffer being shown is never written, and a frame is on the panel from the
+first refresh frame that starts after it arrives.
+
+Any other length (a frame short of clocks, or one too long for the
+buffers) is dropped, and the next frame is received as usual.
+
+With ack_pin, the receiver toggles that pin every time latest() takes a new
+frame, so the sender can tell which of its frames were shown and how fast
+the panel takes them, and send only what the panel can show.
+
+With progressive, for a sender that encodes its frames with
+frame_compiler.progressive_planes, a frame goes on show before it is
+whole: latest() reads the DMA count, and once 1, 3 or 5 (PROGRESSIVE_STAGES)
+of its planes have landed it shows the buffer still being written as a
+frame of that many planes, which the encoding makes a fair copy of the
+whole one.  The planes on show are never written again; the rest arrive
+behind them, and the frame is refined at each stage until it is whole.
+The DMA's buffer becomes the front one at the first stage, and the old
+front one takes its place, so the ready and front buffers are still never
+written.  A frame that turns out too short or too long stays on show at
+the last stage it reached.
+
+The defaults use pins display.py leaves free (data on GPIO 16-21, PCLK on
+22, FRAME on 8, ACK on 26) and PIO1, which is otherwise used by the SDIO
+driver, so live input and frames from an SDIO card do not run together.
+"""
+
+from machine import Pin
+from micropython import const
+from rp2 import StateMachine, asm_pio, PIO, DMA
+import _thread
+import rp2
+import tracebuf
+
+
+_PIO_BASES = (0x50200000, 0x50300000)
+_PIO_RXF0 = const(0x020)
+_DREQ_PIO_RX0 = (4, 12)
+
+DATA_BITS = const(6)
+MIN_BLANKING_US = const(500)
+PLANE_COUNT = const(15)
+PROGRESSIVE_STAGES = (1, 3, 5)
+
+
+def frame_rx_program(pclk_pin):
+    rp2._pio_funcs["pclk_pin"] = pclk_pin
+    rp2._pio_funcs["data_bits"] = DATA_BITS
+    rp2._pio_funcs["pad_bits"] = 8 - DATA_BITS
+
+    # The data is read once PCLK is seen high, half a clock after the sender
+    # set it up, and FRAME (the jmp pin) with it.  A partial word left in the
+    # ISR at the end of a frame is dropped, so the next frame starts a new word
+    @asm_pio(in_shiftdir=PIO.SHIFT_RIGHT, autopush=True, push_thresh=32)
+    def frame_rx():
+        wrap_target()
+        wait(1, gpio, pclk_pin)
+        in_(pins, data_bits)
+        in_(null, pad_bits)
+        jmp(pin, "Next")
+        irq(rel(0))
+        mov(isr, null)
+        label("Next")
+        wait(0, gpio, pclk_pin)
+        wrap()
+
+    return frame_rx
+
+
+class FrameReceiver:
+    def __init__(self, frame_size, data_base=16, pclk_pin=22, frame_pin=8, pio=1, sm=0, freq=None, ack_pin=None,
+                 progressive=False):
+        if frame_size % (4 * PLANE_COUNT):
+            raise ValueError("frame_size should be %d planes of whole words, not %d bytes" % (PLANE_COUNT, frame_size))
+        self.frame_size = frame_size
+        self.plane_size = frame_size // PLANE_COUNT
+        self.frames = 0
+        self.dropped = 0
+        # One word more than a full frame, so a frame that is too long shows
+        # as one; latest() gives views of a full frame's length
+        self._buffers = [bytearray(frame_size + 4) for _ in range(3)]
+        self.buffers = [memoryview(buffer)[:frame_size] for buffer in self._buffers]
+        self._planes = [PLANE_COUNT] * 3
+        self.planes = PLANE_COUNT
+        self._front, self._ready, self._back = 0, 1, 2
+        self._fresh = False
+        self.progressive = progressive
+        # Planes of the frame being received already on show, 0 for none
+        self._partial = 0
+        self._lock = _thread.allocate_lock()
+
+        for pin in range(data_base, data_base + DATA_BITS):
+            Pin(pin, Pin.IN)
+        Pin(pclk_pin, Pin.IN)
+        Pin(frame_pin, Pin.IN, Pin.PULL_DOWN)
+        self._ack = None if ack_pin is None else Pin(ack_pin, Pin.OUT, value=0)
+
+        kwargs = {} if freq is None else {"freq": freq}
+        self._sm = StateMachine(pio * 4 + sm, frame_rx_program(pclk_pin), in_base=Pin(data_base),
+                                jmp_pin=Pin(frame_pin), **kwargs)
+        self._sm.irq(self._frame_done)
+        self._rx_fifo = _PIO_BASES[pio] + _PIO_RXF0 + 4 * sm
+        self._dma = DMA()
+        self._ctrl = self._dma.pack_ctrl(size=2, inc_read=False, inc_write=True, treq_sel=_DREQ_PIO_RX0[pio] + sm)
+        self._dma.irq(self._overrun)
+        self._words = len(self._buffers[0]) // 4
+        self._arm()
+        self._sm.active(1)
+
+    def _arm(self):
+        # The back buffer is never the one on show.  After a frame that fits
+        # the channel still has its spare word to go, and config() on a busy
+        # channel moves WRITE_ADDR under it without triggering, so stop it first
+        self._dma.active(0)
+        self._dma.config(read=self._rx_fifo, write=self._buffers[self._back], count=self._words, ctrl=self._ctrl,
+                         trigger=True)
+
+    def _frame_done(self, sm):
+        size = 4 * (self._words - self._dma.count)
+        planes = size // self.plane_size
+        valid = size == planes * self.plane_size and planes and PLANE_COUNT % planes == 0
+        with self._lock:
+            partial, self._partial = self._partial, 0
+            if partial == PLANE_COUNT:
+                # Overran, see _overrun
+                valid = False
+            elif partial:
+                # Already the front buffer, see latest()
+                if valid:
+                    self._planes[self._front] = planes
+            elif valid:
+                self._planes[self._back] = planes
+                self._ready, self._back = self._back, self._ready
+                self._fresh = True
+            # Re-armed before latest() can look: until then the DMA count is
+            # still the finished frame's, which _show_partial() would take for
+            # a new frame fully landed
+            self._arm()
+        if valid:
+            self.frames += 1
+            tracebuf.record(tracebuf.FRAME_IN, planes)
+        else:
+            self.dropped += 1
+
+    def _overrun(self, dma):
+        # The DMA only runs out in a frame too long for the buffers: the state
+        # machine stalls when the FIFO fills, so it is restarted (the rest of
+        # the frame is dropped when it ends)
+        self._sm.restart()
+        while self._sm.rx_fifo():
+            self._sm.get()
+        self.dropped += 1
+        # No more of the frame is shown early, and what arrives is dropped
+        with self._lock:
+            self._partial = PLANE_COUNT
+        self._arm()
+
+    def latest(self):
+        # The newest complete frame (all zeros, a dark panel, until the
+        # first arrives); it is not written until the next call.  planes is
+        # the number of planes it holds
+        with self._lock:
+            if self._fresh:
+                self._front, self._ready = self._ready, self._front
+                self._fresh = False
+                if self._ack is not None:
+                    self._ack.value(not self._ack.value())
+            elif self.progressive:
+                self._show_partial()
+            self.planes = self._planes[self._front]
+            return self.buffers[self._front]
+
+    def _show_partial(self):
+        landed = 4 * (self._words - self._dma.count) // self.plane_size
+        stage = self._partial
+        for planes in PROGRESSIVE_STAGES:
+            if planes <= landed:
+                stage = planes
+        if stage <= self._partial:
+            return
+        if not self._partial:
+            self._front, self._back = self._back, self._front
+            if self._ack is not None:
+                self._ack.value(not self._ack.value())
+        self._planes[self._front] = stage
+        self._partial = stage
+
+    def close(self):
+        self._sm.active(0)
+        self._sm.irq(None)
+        self._dma.close()
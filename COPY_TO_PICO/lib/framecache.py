@@ -0,0 +1,78 @@
+"""
+Frame cache: frames read from storage, with the row lists made for them,
+kept in RAM up to a byte budget so a playlist that loops shows them again
+without reading, allocating or building anything.
+
+Entries are keyed by playlist item (the frame's path).  When a new frame
+does not fit, the least recently used ones are dropped until it does; a
+frame bigger than the whole budget is not kept.  A playlist that loops
+through more frames than the budget holds drops each frame just before it
+comes round again, so the budget should hold the whole loop.
+
+    cache = framecache.FrameCache(96_000)
+    entry = cache.get(path)             # (frame, rows), or None
+    if entry is None:
+        ...read the frame and make its rows
+        cache.put(path, frame, rows)
+
+hits, misses, kb_saved (KiB of frames not read again) and used are kept
+for telemetry.  A frame's size is counted as its bytes plus ROW_VIEW_BYTES
+for every row view in its row list.
+"""
+
+ROW_VIEW_BYTES = 16
+
+
+class FrameCache:
+    def __init__(self, budget):
+        self.budget = budget
+        self.entries = {}
+        # Keys, least recently used first
+        self.order = []
+        self.used = 0
+        self.hits = 0
+        self.misses = 0
+        self.kb_saved = 0
+        self._saved = 0
+
+    def get(self, key):
+        entry = self.entries.get(key)
+        if entry is None:
+            self.misses += 1
+            return None
+        self.hits += 1
+        # Kept in KiB, with the remainder apart, so it stays a small int
+        saved = self._saved + len(entry[0])
+        self.kb_saved += saved >> 10
+        self._saved = saved & 1023
+        order = self.order
+        if order[-1] != key:
+            order.remove(key)
+            order.append(key)
+        return entry
+
+    def put(self, key, frame, rows):
+        if key in self.entries:
+            self._drop(key)
+        size = entry_size(frame, rows)
+        if size > self.budget:
+            return
+        while self.used + size > self.budget:
+            self._drop(self.order[0])
+        self.entries[key] = (frame, rows)
+        self.order.append(key)
+        self.used += size
+
+    def clear(self):
+        self.entries = {}
+        self.order = []
+        self.used = 0
+
+    def _drop(self, key):
+        frame, rows = self.entries.pop(key)
+        self.order.remove(key)
+        self.used -= entry_size(frame, rows)
+
+
+def entry_size(frame, rows):
+    return len(frame) + (0 if rows is None else ROW_VIEW_BYTES * len(rows))
@@ -0,0 +1,492 @@
+"""
+HUB-75 refresh programs.
+
+Two state machines on PIO0 drive the panel:
+
+    led_data         shifts one row of frame bytes out on the six color pins,
+                     clocking each column with side-set, then signals the
+                     address counter and waits for it to latch
+    address_counter  steps through the row addresses in the scan order,
+                     latches the row that was just shifted in, and lets
+                     led_data start the next one
+
+The first word led_data pulls is its column count less one; everything after
+that is frame data, one byte per column (see png_to_frame.py for the layout).
+
+Scan orders (SCAN_ORDERS) set the order the (plane, address) row slots of a
+frame are shown in:
+
+    sequential   every address of plane 0, counting down, then plane 1, ...
+    interleaved  as sequential, but odd addresses before even ones, so each
+                 pass over the panel lights every other row; neighbouring
+                 rows are half a plane apart and a pair of rows flickers at
+                 twice the plane rate
+    row_planes   all planes of one address back to back, then the next
+                 address; every row is complete in one visit, but each LED
+                 is lit in a single burst per frame
+
+address_counter works the addresses out itself; the frame data has to come
+in the same order, which frame_compiler.py does for full resolution frames
+(scan_order) and the feeder's row list (frame_rows) does otherwise.
+
+With skip_dark_rows, row slots with nothing lit are not shifted at all.  The
+feeder gives address_counter a word of dark bits ahead of each group of
+slots (a plane, or for 'row_planes' an address) and sends led_data only the
+rows that light something; address_counter passes over a dark slot without
+latching, so the row before it stays on show, for the same time as every
+other row, while the next lit row shifts in.  A frame then takes
+row_cycles for each lit slot only, and the panel gets brighter the more of
+it is dark.  frame_compiler.py can store the dark bits with the frame and
+leave the dark rows out (skip_dark_rows); for any other frame the feeder
+finds them when it makes its row list.
+
+With a pixel scale above 1 the stored frame is at 1/scale of the panel's
+resolution in both directions: led_data repeats every byte for 'scale'
+columns, and the feeder sends every stored row for 'scale' addresses, so a
+32x16 frame fills a 64x32 panel exactly as the upscaled 64x32 frame would,
+from a quarter of the memory.
+
+By default led_data changes the data lines in the same cycle as the clock
+rises, three PIO cycles to a column, which only works because PIO_FREQ
+keeps the cycles long.  With a ShiftTiming (shift_timing()) the programs
+take their timing from nanosecond figures instead, so they can run at or
+near the system clock: data is set 'setup' cycles before each rising edge
+and the clock is high for 'high' cycles, and address_counter holds a new
+address 'address_setup' cycles before raising LAT for 'latch' cycles.
+shift_timing() works out the cycles for a system clock and the smallest
+clock divider that fits them in the instructions' delay fields.  Those
+cycles are long enough to show the old row at the new address, so in
+this mode address_counter also drives OE (the pin after LAT), blanking the
+panel from the address change until LAT falls; the CPU's enable pin then
+does nothing, and the panel is blanked with
+address_counter_sm.exec("set(pins, 2)") instead.
+
+With a ShiftTiming, dim_planes (1 to DIM_PLANES_MAX) shows frames that
+frame_compiler.py made with the same dim_planes: after the PLANE_COUNT
+planes come that many more, each shifted and latched like any other row
+but lit for only 1/2, 1/4, ... of a full plane's time, so lower bits of
+color cost one row slot each instead of idle time shorter than a shift.
+address_counter takes a word ahead of each plane (plane_on_cycles) and
+keeps OE on for that many cycles after every latch; full planes are lit
+until just before the next row is due, so any row the feeder is late
+with is dark for the extra time rather than brighter.  Not with
+skip_dark_rows or 'row_planes'.
+"""
+
+from machine import Pin
+from rp2 import StateMachine, asm_pio, PIO
+import rp2
+
+# PIO cycles a row takes besides clocking its columns: reloading the column
+# count and the two IRQ handshakes with address_counter around the latch
+ROW_OVERHEAD_CYCLES = 7
+
+PLANE_COUNT = 15
+
+# Largest delay, in cycles, an instruction of the timed led_data (one
+# side-set bit on every instruction) and of address_counter (none) can add
+LED_DATA_MAX_DELAY = 15
+ADDRESS_COUNTER_MAX_DELAY = 31
+
+DIM_PLANES_MAX = 4
+
+# address_counter's cycles, with dim planes, from OE going off after a row
+# to waiting for the next one: the interleaved address and a plane's word
+DIM_TAIL_CYCLES = 11
+
+SCAN_ORDERS = ("sequential", "interleaved", "row_planes")
+
+
+class ShiftTiming:
+    # Cycles, each at least 1, for state machines running at freq
+    def __init__(self, freq, setup, high, address_setup, latch):
+        self.freq = freq
+        self.setup = setup
+        self.high = high
+        self.address_setup = address_setup
+        self.latch = latch
+
+    def clock_hz(self, pixel_scale=1):
+        # Columns clocked per second within a row
+        if pixel_scale == 1:
+            return self.freq / (1 + self.setup + self.high)
+        return self.freq * pixel_scale / (2 + pixel_scale * (self.setup + self.high))
+
+
+def shift_timing(sys_freq, setup_ns, high_ns, address_setup_ns, latch_ns):
+    # The fastest ShiftTiming that keeps every figure at least as long as
+    # asked, dividing sys_freq down only if a delay would not fit
+    divider = 1
+    while True:
+        freq = sys_freq // divider
+        cycles = [max(1, -(-ns * freq // 1_000_000_000)) for ns in (setup_ns, high_ns, address_setup_ns, latch_ns)]
+        if max(cycles[:2]) <= LED_DATA_MAX_DELAY + 1 and max(cycles[2:]) <= ADDRESS_COUNTER_MAX_DELAY + 1:
+            return ShiftTiming(freq, *cycles)
+        divider += 1
+
+
+def led_data_program(pixel_scale=1, timing=None):
+    if timing is not None:
+        return timed_led_data_program(pixel_scale, timing)
+    if pixel_scale == 1:
+        @asm_pio(out_init=(rp2.PIO.OUT_LOW,) * 6, sideset_init=rp2.PIO.OUT_LOW,
+                 out_shiftdir=PIO.SHIFT_RIGHT)
+        def led_data():
+            pull()
+            mov(isr, osr)
+            wrap_target()
+            mov(x, isr)
+            label("Byte Counter")
+            pull().side(0)
+            out(pins, 6).side(1)
+            jmp(x_dec, "Byte Counter")
+            irq(block, 4)
+            irq(block, 5)
+            wrap()
+
+        return led_data
+
+    # Each byte pulled is clocked out 'pixel_scale' times; loading the repeat
+    # count in the first clock-low slot keeps this at the same three cycles
+    # per panel column as the program above
+    rp2._pio_funcs["pixel_repeat"] = pixel_scale - 2
+
+    @asm_pio(out_init=(rp2.PIO.OUT_LOW,) * 6, sideset_init=rp2.PIO.OUT_LOW,
+             out_shiftdir=PIO.SHIFT_RIGHT)
+    def led_data_scaled():
+        pull()
+        mov(isr, osr)
+        wrap_target()
+        mov(x, isr)
+        label("Byte Counter")
+        pull().side(0)
+        mov(pins, osr).side(1)
+        set(y, pixel_repeat).side(0)
+        label("Pixel Repeat")
+        mov(pins, osr).side(1)
+        jmp(y_dec, "Pixel Repeat").side(0)
+        jmp(x_dec, "Byte Counter")
+        irq(block, 4)
+        irq(block, 5)
+        wrap()
+
+    return led_data_scaled
+
+
+def timed_led_data_program(pixel_scale, timing):
+    # Data goes out with the clock low and is held 'setup' cycles before it
+    # rises; the clock then stays high for 'high' cycles, and the data is
+    # not changed until it has fallen.  Every instruction side-sets, so the
+    # side-set is not optional and the delays get four bits
+    rp2._pio_funcs["setup_delay"] = timing.setup - 1
+    rp2._pio_funcs["high_delay"] = timing.high - 1
+    if pixel_scale == 1:
+        @asm_pio(out_init=(rp2.PIO.OUT_LOW,) * 6, sideset_init=rp2.PIO.OUT_LOW,
+                 out_shiftdir=PIO.SHIFT_RIGHT)
+        def led_data_timed():
+            pull().side(0)
+            mov(isr, osr).side(0)
+            wrap_target()
+            mov(x, isr).side(0)
+            label("Byte Counter")
+            pull().side(0)
+            out(pins, 6).side(0)[setup_delay]
+            jmp(x_dec, "Byte Counter").side(1)[high_delay]
+            irq(block, 4).side(0)
+            irq(block, 5).side(0)
+            wrap()
+
+        return led_data_timed
+
+    # Repeats of a byte keep the data lines as they are, so the clock only
+    # has to be low for 'setup' cycles between them
+    rp2._pio_funcs["pixel_repeat"] = pixel_scale - 2
+
+    @asm_pio(out_init=(rp2.PIO.OUT_LOW,) * 6, sideset_init=rp2.PIO.OUT_LOW,
+             out_shiftdir=PIO.SHIFT_RIGHT)
+    def led_data_scaled_timed():
+        pull().side(0)
+        mov(isr, osr).side(0)
+        wrap_target()
+        mov(x, isr).side(0)
+        label("Byte Counter")
+        pull().side(0)
+        mov(pins, osr).side(0)[setup_delay]
+        set(y, pixel_repeat).side(1)[high_delay]
+        label("Pixel Repeat")
+        nop().side(0)[setup_delay]
+        jmp(y_dec, "Pixel Repeat").side(1)[high_delay]
+        jmp(x_dec, "Byte Counter").side(0)
+        irq(block, 4).side(0)
+        irq(block, 5).side(0)
+        wrap()
+
+    return led_data_scaled_timed
+
+
+def address_bits(address_count):
+    bits = 0
+    while 1 << bits < address_count:
+        bits += 1
+    return bits
+
+
+def dark_group_size(address_count, scan_order="sequential"):
+    # Row slots covered by each word of dark bits
+    return PLANE_COUNT if scan_order == "row_planes" else address_count
+
+
+def address_counter_program(address_count, scan_order="sequential", skip_dark_rows=False, timing=None, dim_planes=0):
+    if scan_order not in SCAN_ORDERS:
+        raise ValueError("scan_order should be one of %s, not %s" % (", ".join(SCAN_ORDERS), scan_order))
+    rp2._pio_funcs["max_address_val"] = address_count - 1
+    rp2._pio_funcs["address_delay"] = 0 if timing is None else timing.address_setup - 1
+    rp2._pio_funcs["latch_delay"] = 0 if timing is None else timing.latch - 1
+    rp2._pio_funcs["plane_repeat"] = PLANE_COUNT - 1 if scan_order == "row_planes" else 0
+    bits = address_bits(address_count)
+    rp2._pio_funcs["low_address_bits"] = bits - 1
+    interleaved = scan_order == "interleaved"
+
+    # x counts down; the address shown is x, or for 'interleaved' x rotated
+    # left one bit (15, 13, ... 1, 14, 12, ... 0), worked out in the ISR
+    # while led_data is still shifting the row.  Skipping dark rows, the
+    # OSR holds the group's dark bits, one per slot, pulled at the start of
+    # each plane (or each address for 'row_planes', where !OSRE ends the
+    # address's planes; 'interleaved' parks them in y while it borrows the
+    # OSR); a dark slot moves on without waiting for led_data.  With
+    # dim_planes the OSR holds the plane's lit cycles instead, and y counts
+    # them down after each latch
+    row_planes = scan_order == "row_planes"
+    plane_words = skip_dark_rows or dim_planes
+
+    # With a ShiftTiming the set pins are LAT and OE, which blanks the panel
+    # from before the address changes until the new row is latched
+    @asm_pio(out_init=(rp2.PIO.OUT_LOW,) * 4, set_init=(rp2.PIO.OUT_HIGH, ) * (1 if timing is None else 2),
+             out_shiftdir=PIO.SHIFT_RIGHT, pull_thresh=dark_group_size(address_count, scan_order))
+    def address_counter():
+        label("Frame")
+        if plane_words and not row_planes:
+            pull()
+        set(x, max_address_val)
+        label("Address Decrement")
+        if interleaved:
+            if plane_words:
+                mov(y, osr)
+            mov(isr, null)
+            in_(x, low_address_bits)
+            mov(osr, x)
+            out(null, low_address_bits)
+            in_(osr, 1)
+            if plane_words:
+                mov(osr, y)
+        else:
+            mov(isr, x)
+        if skip_dark_rows:
+            if row_planes:
+                pull()
+            label("Plane")
+            out(y, 1)
+            jmp(not_y, "Latch")
+            if row_planes:
+                jmp(not_osre, "Plane")
+            jmp(x_dec, "Address Decrement")
+            jmp("Frame")
+            label("Latch")
+        elif not dim_planes:
+            set(y, plane_repeat)
+            label("Plane")
+        wait(1, irq, 4)
+        if timing is not None:
+            set(pins, 2)
+        mov(pins, isr)[address_delay]
+        set(pins, 1 if timing is None else 3)[latch_delay]
+        set(pins, 0)
+        irq(clear, 5)
+        if dim_planes:
+            mov(y, osr)
+            label("Lit")
+            jmp(y_dec, "Lit")
+            set(pins, 2)
+        elif skip_dark_rows:
+            if row_planes:
+                jmp(not_osre, "Plane")
+        else:
+            jmp(y_dec, "Plane")
+        jmp(x_dec, "Address Decrement")
+
+    return address_counter
+
+
+def scan_slots(address_count, scan_order="sequential", planes=PLANE_COUNT):
+    # The (plane, address) of every row slot of a frame, in the order shown
+    bits = address_bits(address_count)
+    counts = range(address_count - 1, -1, -1)
+    if scan_order == "interleaved":
+        addresses = [((count << 1) | (count >> (bits - 1))) & (address_count - 1) for count in counts]
+    else:
+        addresses = list(counts)
+    if scan_order == "row_planes":
+        return [(plane, address) for address in addresses for plane in range(planes)]
+    return [(plane, address) for plane in range(planes) for address in addresses]
+
+
+def init_state_machines(freq, width, address_count, pixel_scale=1, scan_order="sequential", skip_dark_rows=False,
+                        data_base=10, clock_pin=9, address_base=0, latch_pin=4, timing=None, dim_planes=0):
+    # With a ShiftTiming, the state machines run at its freq, not 'freq',
+    # and address_counter takes over OE on latch_pin + 1
+    if width % pixel_scale or (2 * address_count) % pixel_scale:
+        raise ValueError("pixel_scale %d does not divide a %dx%d panel" % (pixel_scale, width, 2 * address_count))
+    if not 0 <= dim_planes <= DIM_PLANES_MAX:
+        raise ValueError("dim_planes should be 0 to %d, not %d" % (DIM_PLANES_MAX, dim_planes))
+    if dim_planes and (timing is None or skip_dark_rows or scan_order == "row_planes"):
+        raise ValueError("dim_planes needs a ShiftTiming, and not skip_dark_rows or 'row_planes'")
+    if timing is not None:
+        freq = timing.freq
+
+    led_data_sm = StateMachine(0, led_data_program(pixel_scale, timing), freq=freq, out_base=Pin(data_base),
+                               sideset_base=Pin(clock_pin))
+    address_counter_sm = StateMachine(1, address_counter_program(address_count, scan_order, skip_dark_rows, timing,
+                                                                 dim_planes), freq=freq, out_base=Pin(address_base), set_base=Pin(latch_pin))
+
+    led_data_sm.put(width // pixel_scale - 1)
+    return led_data_sm, address_counter_sm
+
+
+def row_cycles(width, pixel_scale=1, timing=None):
+    # PIO cycles per panel row, as long as the TX FIFO never runs dry
+    if timing is not None:
+        overhead = ROW_OVERHEAD_CYCLES + timing.address_setup + timing.latch - 1
+        if pixel_scale == 1:
+            return (1 + timing.setup + timing.high) * width + overhead
+        return (2 + pixel_scale * (timing.setup + timing.high)) * (width // pixel_scale) + overhead
+    if pixel_scale == 1:
+        return 3 * width + ROW_OVERHEAD_CYCLES
+    return (2 * pixel_scale + 2) * (width // pixel_scale) + ROW_OVERHEAD_CYCLES
+
+
+def plane_on_cycles(width, pixel_scale, timing, dim_planes):
+    # address_counter's word ahead of each plane, for dim_planes: a row is
+    # lit for its word plus 4 cycles.  A full plane stays lit until
+    # DIM_TAIL_CYCLES before the next row is due, the dim ones for 1/2,
+    # 1/4, ... of that
+    lit = row_cycles(width, pixel_scale, timing) - (1 + timing.address_setup + timing.latch) - DIM_TAIL_CYCLES
+    return [lit - 4] * PLANE_COUNT + [max(0, (lit >> (bit + 1)) - 4) for bit in range(dim_planes)]
+
+
+def frame_rows(frame, width, address_count, pixel_scale=1, scan_order="sequential", in_scan_order=True,
+               skip_dark_rows=False, planes=PLANE_COUNT, on_cycles=None):
+    # The feeder's display list: a view of the stored row to send for every
+    # row slot, in the order they are shown.  Made once per frame so the
+    # feeder loop itself allocates nothing; None when the frame can be sent
+    # as it is, which it can at full resolution if the rows are already in
+    # scan order (compiled with the same scan_order) or the scan is
+    # sequential.  Rows are otherwise taken to be in png_to_frame.py's
+    # sequential layout.  With skip_dark_rows it is a list of (dark bits,
+    # rows to send) per group of slots instead, see dark_row_groups.  A
+    # frame of fewer planes (a divisor of PLANE_COUNT, sequential layout)
+    # has each of its planes shown in turn in place of the full frame's.
+    # With on_cycles (plane_on_cycles), for a frame with dim planes, it is a
+    # list of (lit cycles, rows to send) per plane, see dim_plane_groups
+    if on_cycles is not None:
+        return dim_plane_groups(frame, width, address_count, pixel_scale, scan_order, in_scan_order, on_cycles)
+    if skip_dark_rows:
+        return dark_row_groups(frame, width, address_count, pixel_scale, scan_order, in_scan_order)
+    if planes == PLANE_COUNT and pixel_scale == 1 and (in_scan_order or scan_order == "sequential"):
+        return None
+    if pixel_scale == 1 and scan_order == "sequential" and PLANE_COUNT % planes == 0:
+        # The frame's planes, one view, as often as it takes
+        return [memoryview(frame)[:planes * address_count * width]] * (PLANE_COUNT // planes)
+    return slot_rows(frame, width, address_count, pixel_scale, scan_order, planes)
+
+
+def slot_views(frame, width, address_count, pixel_scale=1, scan_order="sequential", in_scan_order=True):
+    # A view of the stored row for every row slot, in the order shown,
+    # whatever the frame's layout (not for frames compiled skip_dark_rows)
+    if pixel_scale == 1 and (in_scan_order or scan_order == "sequential"):
+        view = memoryview(frame)
+        return [view[start:start + width] for start in range(0, PLANE_COUNT * address_count * width, width)]
+    return slot_rows(frame, width, address_count, pixel_scale, scan_order)
+
+
+def slot_rows(frame, width, address_count, pixel_scale=1, scan_order="sequential", planes=PLANE_COUNT):
+    if PLANE_COUNT % planes:
+        raise ValueError("a frame holds a divisor of %d planes, not %d" % (PLANE_COUNT, planes))
+    row_bytes = width // pixel_scale
+    stored_rows = address_count // pixel_scale
+    view = memoryview(frame)
+    rows = []
+    for plane, address in scan_slots(address_count, scan_order):
+        start = (plane % planes * stored_rows + (address_count - 1 - address) // pixel_scale) * row_bytes
+        rows.append(view[start:start + row_bytes])
+    return rows
+
+
+def dim_plane_groups(frame, width, address_count, pixel_scale=1, scan_order="sequential", in_scan_order=True,
+                     on_cycles=()):
+    # A full resolution frame in scan order sends each plane as one view
+    view = memoryview(frame)
+    if pixel_scale == 1 and (in_scan_order or scan_order == "sequential"):
+        size = address_count * width
+        return [(on, [view[plane * size:(plane + 1) * size]]) for plane, on in enumerate(on_cycles)]
+    row_bytes = width // pixel_scale
+    stored_rows = address_count // pixel_scale
+    addresses = [address for plane, address in scan_slots(address_count, scan_order)[:address_count]]
+    groups = []
+    for plane, on in enumerate(on_cycles):
+        rows = []
+        for address in addresses:
+            start = (plane * stored_rows + (address_count - 1 - address) // pixel_scale) * row_bytes
+            rows.append(view[start:start + row_bytes])
+        groups.append((on, rows))
+    return groups
+
+
+def dark_row_groups(frame, width, address_count, pixel_scale=1, scan_order="sequential", in_scan_order=True):
+    # Bit n of a group's word is set when its n-th slot lights nothing.  A
+    # full resolution frame in scan order is taken to be compiled with
+    # skip_dark_rows: the words, little endian, then only the lit rows.
+    # Otherwise every row is checked here.  At least one slot of a frame is
+    # always sent, or the last row of the frame before would stay lit
+    group_size = dark_group_size(address_count, scan_order)
+    count = PLANE_COUNT * address_count // group_size
+    view = memoryview(frame)
+    groups = []
+    if pixel_scale == 1 and in_scan_order:
+        start = 4 * count
+        for group in range(count):
+            dark = int.from_bytes(frame[4 * group:4 * group + 4], "little")
+            end = start + (group_size - bin(dark).count("1")) * width
+            groups.append((dark, [view[start:end]] if end > start else []))
+            start = end
+        return groups
+
+    rows = slot_rows(frame, width, address_count, pixel_scale, scan_order)
+    for group in range(count):
+        dark = 0
+        lit = []
+        for slot in range(group_size):
+            row = rows[group * group_size + slot]
+            if any(row):
+                lit.append(row)
+            else:
+                dark |= 1 << slot
+        groups.append((dark, lit))
+    if not any(lit for dark, lit in groups):
+        groups[0] = (groups[0][0] & ~1, [rows[0]])
+    return groups
+
+
+def put_frame(led_data_sm, frame, rows, address_counter_sm=None):
+    # address_counter_sm is only given when skipping dark rows or with dim
+    # planes; rows are then (word for address_counter, rows) groups
+    if rows is None:
+        led_data_sm.put(frame)
+        return
+    if address_counter_sm is None:
+        for row in rows:
+            led_data_sm.put(row)
+        return
+    for dark, group in rows:
+        address_counter_sm.put(dark)
+        for row in group:
+            led_data_sm.put(row)
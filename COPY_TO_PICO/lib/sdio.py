@@ -0,0 +1,291 @@
+"""
+MicroPython driver for SD cards using the 4-bit SDIO bus.
+
+This module holds the protocol side of the driver (command framing, CRCs,
+card initialisation and block transfers) and talks to the card through a
+"bus" object that does the actual signalling.  On the Pico that is
+sdio_pio.PIOBus, which runs the bus on a spare PIO block with DMA; on a PC it
+is sdio_model.ModelBus, which lets the same code be exercised against a
+simulated card.
+
+Provides readblocks and writeblocks methods so the device can be mounted as a
+filesystem, exactly like sdcard.SDCard.
+
+Example usage on the Pico:
+
+    import os, sdio, sdio_pio
+    from machine import Pin
+    sd = sdio.SDIOCard(sdio_pio.PIOBus(clk=Pin(18), cmd=Pin(19), d0=Pin(20)))
+    os.mount(sd, '/sd')
+    os.listdir('/sd')
+
+D0-D3 must be on consecutive pins, starting at d0.
+
+"""
+
+from micropython import const
+from array import array
+import time
+
+
+_CMD_TIMEOUT = const(100)
+
+_INIT_FREQ = const(400_000)
+_DATA_FREQ = const(25_000_000)
+
+# Response lengths in bits, including start and end bits
+_R1 = const(48)
+_R2 = const(136)
+_R3 = const(48)
+
+# Card status (R1) bits
+_R1_ERRORS = const(0xFDF98008)
+_R1_READY_FOR_DATA = const(1 << 8)
+_R1_STATE_TRAN = const(4)
+
+_OCR_BUSY = const(1 << 31)
+_OCR_CCS = const(1 << 30)
+_ACMD41_ARG = const(0x40FF8000)  # HCS, 2.7-3.6V window
+
+_CRC_STATUS_OK = const(0b010)
+
+# CRC16-CCITT sent independently on each of D0-D3 is, once the lanes are
+# interleaved back into the byte stream, a single CRC over
+# x^64 + x^48 + x^20 + 1 (the CCITT polynomial with x replaced by x^4).
+# Kept as two 32-bit halves so the device can do it without bignums.
+_CRC16X4_POLY_HI = const(0x00010000)
+_CRC16X4_POLY_LO = const(0x00100001)
+
+
+def crc7(buf, n):
+    crc = 0
+    for i in range(n):
+        crc ^= buf[i]
+        for _ in range(8):
+            crc = (crc << 1) ^ 0x12 if crc & 0x80 else crc << 1
+        crc &= 0xFF
+    return crc >> 1
+
+
+def _crc16x4_tables():
+    table_hi = array("I", bytes(1024))
+    table_lo = array("I", bytes(1024))
+    for i in range(256):
+        hi = i << 24
+        lo = 0
+        for _ in range(8):
+            carry = hi & 0x80000000
+            hi = ((hi << 1) | (lo >> 31)) & 0xFFFFFFFF
+            lo = (lo << 1) & 0xFFFFFFFF
+            if carry:
+                hi ^= _CRC16X4_POLY_HI
+                lo ^= _CRC16X4_POLY_LO
+        table_hi[i] = hi
+        table_lo[i] = lo
+    return table_hi, table_lo
+
+
+CRC16X4_TABLE_HI, CRC16X4_TABLE_LO = _crc16x4_tables()
+
+
+def crc16x4(data, out):
+    # Writes the 8 CRC bytes of a 4-bit bus data block into out, in the order
+    # they appear on the wire.
+    hi = 0
+    lo = 0
+    table_hi = CRC16X4_TABLE_HI
+    table_lo = CRC16X4_TABLE_LO
+    for b in data:
+        idx = (hi >> 24) ^ b
+        hi = (((hi << 8) & 0xFFFFFFFF) | (lo >> 24)) ^ table_hi[idx]
+        lo = ((lo << 8) & 0xFFFFFFFF) ^ table_lo[idx]
+    for i in range(4):
+        out[i] = (hi >> (24 - 8 * i)) & 0xFF
+        out[4 + i] = (lo >> (24 - 8 * i)) & 0xFF
+
+
+def crc16x4_matches(data, crc):
+    calc = bytearray(8)
+    crc16x4(data, calc)
+    return calc == bytes(crc)
+
+
+def crc_status(samples):
+    # The tx state machine samples all four data lines for 16 clocks after a
+    # written block; the card answers on D0 with a start bit, a 3 bit status
+    # and an end bit.  Returns the status, or -1 if no token was seen.
+    bits = 0
+    count = 0
+    for word in samples:
+        for shift in range(28, -1, -4):
+            bits = (bits << 1) | ((word >> shift) & 1)
+            count += 1
+    for i in range(count - 1, 3, -1):
+        if not (bits >> i) & 1:
+            return (bits >> (i - 3)) & 0b111
+    return -1
+
+
+class SDIOCard:
+    def __init__(self, bus):
+        self.bus = bus
+
+        self.cmdbuf = bytearray(6)
+        self.respbuf = bytearray(_R2 // 8)
+        self.crcbuf = bytearray(8)
+        self.statusbuf = array("I", [0, 0])
+        self._crc_matches = getattr(bus, "crc_matches", crc16x4_matches)
+        self._crc16 = getattr(bus, "crc16", crc16x4)
+
+        self.rca = 0
+
+        # initialise the card
+        self.init_card()
+
+    def init_card(self):
+        # low clock rate for identification
+        self.bus.clock(_INIT_FREQ)
+
+        # CMD0: go idle, no response
+        self.cmd(0, 0, 0)
+
+        # CMD8: determine card version, v2 cards echo the check pattern
+        if self.cmd(8, 0x01AA, _R1) and self.respbuf[4] == 0xAA:
+            acmd41_arg = _ACMD41_ARG
+        else:
+            acmd41_arg = _ACMD41_ARG & ~_OCR_CCS
+
+        # ACMD41: wait for the card to finish powering up
+        for _ in range(_CMD_TIMEOUT):
+            if self.cmd(55, 0, _R1) and self.cmd(41, acmd41_arg, _R3, check_crc=False):
+                ocr = self.resp_arg()
+                if ocr & _OCR_BUSY:
+                    self.cdv = 1 if ocr & _OCR_CCS else 512
+                    break
+            time.sleep(0.01)
+        else:
+            raise OSError("no SD card")
+
+        # CMD2: all send CID, CMD3: ask the card for its relative address
+        if not self.cmd(2, 0, _R2, check_crc=False) or not self.cmd(3, 0, _R1):
+            raise OSError("no response from SD card")
+        self.rca = self.resp_arg() >> 16
+
+        # CMD9: read the CSD to get the number of sectors
+        if not self.cmd(9, self.rca << 16, _R2, check_crc=False):
+            raise OSError("no response from SD card")
+        csd = self.respbuf[1:]
+        if crc7(csd, 15) != csd[15] >> 1:
+            raise OSError("SD card CSD CRC error")
+        if csd[0] & 0xC0 == 0x40:  # CSD version 2.0
+            self.sectors = ((csd[7] & 0x3F) << 16 | csd[8] << 8 | csd[9]) * 1024 + 1024
+        elif csd[0] & 0xC0 == 0x00:  # CSD version 1.0 (old, <=2GB)
+            c_size = (csd[6] & 0b11) << 10 | csd[7] << 2 | csd[8] >> 6
+            c_size_mult = ((csd[9] & 0b11) << 1) | csd[10] >> 7
+            read_bl_len = csd[5] & 0x0F
+            self.sectors = (c_size + 1) * (2 ** (c_size_mult + 2)) << (read_bl_len - 9)
+        else:
+            raise OSError("SD card CSD format not supported")
+
+        # CMD7: select the card, moving it to the transfer state
+        if not self.cmd(7, self.rca << 16, _R1):
+            raise OSError("can't select SD card")
+
+        # ACMD6: switch the card to the 4-bit bus
+        if not (self.cmd(55, self.rca << 16, _R1) and self.cmd(6, 2, _R1)):
+            raise OSError("can't set 4-bit bus width")
+
+        # CMD16: set block length to 512 bytes (ignored by SDHC/SDXC)
+        if not self.cmd(16, 512, _R1):
+            raise OSError("can't set 512 block size")
+
+        # set to high data rate now that it's initialised
+        self.bus.clock(_DATA_FREQ)
+
+    def cmd(self, cmd, arg, resp_bits, check_crc=True):
+        # create and send the command; start bit 0, transmission bit 1
+        buf = self.cmdbuf
+        buf[0] = 0x40 | cmd
+        buf[1] = (arg >> 24) & 0xFF
+        buf[2] = (arg >> 16) & 0xFF
+        buf[3] = (arg >> 8) & 0xFF
+        buf[4] = arg & 0xFF
+        buf[5] = crc7(buf, 5) << 1 | 1
+
+        if not resp_bits:
+            self.bus.command(buf, None)
+            return True
+
+        resp = self.respbuf
+        if not self.bus.command(buf, resp, resp_bits):
+            return False
+
+        # R2 (CID/CSD) carries its CRC inside the register and R3 has none
+        if resp_bits == _R1 and check_crc:
+            if resp[0] & 0x3F != cmd or crc7(resp, 5) != resp[5] >> 1:
+                return False
+            # R6 (CMD3) and R7 (CMD8) reuse the R1 frame without card status
+            if cmd != 3 and cmd != 8 and self.resp_arg() & _R1_ERRORS:
+                return False
+        return True
+
+    def resp_arg(self):
+        resp = self.respbuf
+        return resp[1] << 24 | resp[2] << 16 | resp[3] << 8 | resp[4]
+
+    def wait_ready(self):
+        # CMD13: poll the card until it is back in the transfer state
+        for _ in range(_CMD_TIMEOUT * 10):
+            if not self.bus.busy() and self.cmd(13, self.rca << 16, _R1):
+                status = self.resp_arg()
+                if status & _R1_READY_FOR_DATA and (status >> 9) & 0xF == _R1_STATE_TRAN:
+                    return
+            time.sleep(0.001)
+        raise OSError(5)  # EIO
+
+    def readblocks(self, block_num, buf):
+        nblocks = len(buf) // 512
+        assert nblocks and not len(buf) % 512, "Buffer length is invalid"
+        mv = memoryview(buf)
+        bus = self.bus
+        while nblocks:
+            count = min(nblocks, bus.max_blocks)
+            if count == 1:
+                # CMD17: read single block
+                ok = self.cmd(17, block_num * self.cdv, _R1) and bus.read(mv[:512], 1)
+            else:
+                # CMD18: read multiple blocks, then CMD12 to stop the card
+                ok = self.cmd(18, block_num * self.cdv, _R1) and bus.read(mv[: count * 512], count)
+                bus.stop()
+                ok = self.cmd(12, 0, _R1) and ok
+            if not ok:
+                raise OSError(5)  # EIO
+            for i in range(count):
+                if not self._crc_matches(mv[i * 512 : i * 512 + 512], bus.crc(i)):
+                    raise OSError(5)  # EIO
+            mv = mv[count * 512 :]
+            block_num += count
+            nblocks -= count
+
+    def writeblocks(self, block_num, buf):
+        nblocks, err = divmod(len(buf), 512)
+        assert nblocks and not err, "Buffer length is invalid"
+        mv = memoryview(buf)
+        crc = self.crcbuf
+        status = self.statusbuf
+        for i in range(nblocks):
+            block = mv[i * 512 : i * 512 + 512]
+            self._crc16(block, crc)
+            # CMD24: write single block
+            if not self.cmd(24, (block_num + i) * self.cdv, _R1):
+                raise OSError(5)  # EIO
+            if not self.bus.write(block, crc, status) or crc_status(status) != _CRC_STATUS_OK:
+                self.wait_ready()
+                raise OSError(5)  # EIO
+            self.wait_ready()
+
+    def ioctl(self, op, arg):
+        if op == 4:  # get number of blocks
+            return self.sectors
+        if op == 5:  # get block size in bytes
+            return 512
@@ -0,0 +1,370 @@
+"""
+PIO/DMA bus for sdio.SDIOCard.
+
+Runs the SD card's 4-bit SDIO bus on a PIO block that display.py leaves
+free (PIO1 by default).  Three state machines share the block, and all of
+them drive CLK through side-set; only one is ever clocking at a time, and a
+state machine that is stalled leaves CLK where it last put it, so the card
+simply sees the clock pause between phases:
+
+    sdio_cmd   sends 48 bit commands on CMD and reads back the response
+    sdio_rx    waits for a start bit on D0 then reads a whole block + CRC
+    sdio_tx    writes a block + CRC, then samples the card's CRC status
+
+Received data is moved by two DMA channels: one copies the rx FIFO into the
+caller's buffer, the other walks a small table of (address, count) pairs
+and re-arms the first after every block, so the 512 data bytes land
+straight in the buffer and the 8 CRC bytes in a side buffer without the
+CPU touching the stream.
+
+CLK, CMD and D0-D3 all need pull-ups; D0-D3 must be consecutive pins.
+"""
+
+from machine import Pin
+from micropython import const
+from rp2 import StateMachine, asm_pio, PIO, DMA
+from utime import ticks_ms, ticks_diff, sleep_us
+from array import array
+import uctypes
+import micropython
+
+
+_PIO_BASES = (0x50200000, 0x50300000)
+_PIO_TXF0 = const(0x010)
+_PIO_RXF0 = const(0x020)
+_DREQ_PIO_TX0 = (0, 8)
+_DREQ_PIO_RX0 = (4, 12)
+
+_DMA_BASE = const(0x50000000)
+_DMA_AL1_WRITE_ADDR = const(0x18)  # followed by AL1_TRANS_COUNT_TRIG
+_DMA_AL3_TRANS_COUNT = const(0x38)  # followed by AL3_READ_ADDR_TRIG
+
+_BLOCK_NIBBLES = const(1040)  # 512 data bytes + 8 CRC bytes
+_BLOCK_WORDS = const(128)
+_CRC_WORDS = const(2)
+_TX_NIBBLES = const(1049)  # 7 idle + start, data, CRC, end
+
+_CMD_TIMEOUT_MS = const(20)
+_DATA_TIMEOUT_MS = const(250)
+
+
+@asm_pio(sideset_init=PIO.OUT_HIGH, set_init=PIO.IN_HIGH, out_init=PIO.IN_HIGH,
+         out_shiftdir=PIO.SHIFT_LEFT, in_shiftdir=PIO.SHIFT_LEFT,
+         autopull=True, pull_thresh=32, autopush=True, push_thresh=32)
+def sdio_cmd():
+    # Word 0: bits to send - 1, then the first 24 bits of the command
+    # Word 1: the last 24 bits of the command, then response bits - 1
+    out(x, 8)                   .side(1)
+    set(pindirs, 1)             .side(1)
+    label("send")
+    out(pins, 1)                .side(0)
+    jmp(x_dec, "send")          .side(1)
+    set(pindirs, 0)             .side(0)
+    out(x, 8)                   .side(1)
+    label("wait_resp")
+    nop()                       .side(0)
+    jmp(pin, "wait_resp")       .side(1)
+    label("read_resp")
+    in_(pins, 1)                .side(0)
+    jmp(x_dec, "read_resp")     .side(1)
+    push()                      .side(0)
+
+
+@asm_pio(sideset_init=PIO.OUT_HIGH, in_shiftdir=PIO.SHIFT_LEFT,
+         autopush=True, push_thresh=32, fifo_join=PIO.JOIN_RX)
+def sdio_rx():
+    # Y holds the nibbles per block - 1; data is sampled as CLK falls, while
+    # it is still being held from the previous falling edge.
+    wrap_target()
+    label("wait_start")
+    nop()                       .side(1)
+    jmp(pin, "wait_start")      .side(0)
+    mov(x, y)                   .side(1)
+    label("read")
+    in_(pins, 4)                .side(0)
+    jmp(x_dec, "read")          .side(1)
+    wrap()
+
+
+@asm_pio(sideset_init=PIO.OUT_HIGH, set_init=(PIO.IN_HIGH,) * 4, out_init=(PIO.IN_HIGH,) * 4,
+         out_shiftdir=PIO.SHIFT_LEFT, in_shiftdir=PIO.SHIFT_LEFT,
+         autopull=True, pull_thresh=32, autopush=True, push_thresh=32)
+def sdio_tx():
+    # X holds the nibbles to send - 1; data changes as CLK falls
+    set(pindirs, 0b1111)        .side(0)
+    label("send")
+    out(pins, 4)                .side(0)
+    jmp(x_dec, "send")          .side(1)
+    set(pindirs, 0)             .side(0)
+    set(x, 15)                  .side(1)
+    label("status")
+    in_(pins, 4)                .side(0)
+    jmp(x_dec, "status")        .side(1)
+    wrap_target()
+    nop()                       .side(1)
+    wrap()
+
+
+@micropython.viper
+def _crc16x4(data: ptr8, n: int, table_hi: ptr32, table_lo: ptr32, out: ptr8):
+    # Same as sdio.crc16x4, in 32-bit halves that viper can keep in registers
+    hi = uint(0)
+    lo = uint(0)
+    i = 0
+    while i < n:
+        idx = int((hi >> 24) ^ uint(data[i]))
+        hi = ((hi << 8) | (lo >> 24)) ^ uint(table_hi[idx])
+        lo = (lo << 8) ^ uint(table_lo[idx])
+        i += 1
+    out[0] = int(hi >> 24)
+    out[1] = int(hi >> 16)
+    out[2] = int(hi >> 8)
+    out[3] = int(hi)
+    out[4] = int(lo >> 24)
+    out[5] = int(lo >> 16)
+    out[6] = int(lo >> 8)
+    out[7] = int(lo)
+
+
+class PIOBus:
+    def __init__(self, clk, cmd, d0, pio=1, max_blocks=32):
+        import sdio
+
+        self.clk = clk
+        self.cmd_pin = cmd
+        self.d0 = d0
+        self.max_blocks = max_blocks
+
+        self._table_hi = sdio.CRC16X4_TABLE_HI
+        self._table_lo = sdio.CRC16X4_TABLE_LO
+        self._crc_calc = bytearray(8)
+
+        for pin in (clk, cmd, d0):
+            pin.init(Pin.IN, Pin.PULL_UP)
+        d0_id = self._pin_id(d0)
+        for i in range(1, 4):
+            Pin(d0_id + i, Pin.IN, Pin.PULL_UP)
+
+        self._pio_base = _PIO_BASES[pio]
+        self._sm_base = pio * 4
+        self._dreq_tx = _DREQ_PIO_TX0[pio] + 2
+        self._dreq_rx = _DREQ_PIO_RX0[pio] + 1
+        self._freq = 0
+
+        # DMA descriptor table: (write address, word count) per segment,
+        # zero terminated, plus the received CRCs and the tx framing words
+        self._crcs = bytearray(8 * max_blocks)
+        self._descs = array("I", bytes(4 * (4 * max_blocks + 2)))
+        self._tx_descs = array("I", bytes(4 * 10))
+        self._tx_head = array("I", [0xF0FFFFFF])  # 7 idle nibbles + start
+        self._tx_tail = array("I", [0x000000F0])  # end nibble
+        self._bounce = bytearray(512)
+        self._resp_words = array("I", bytes(4 * 5))
+
+        self._data_dma = DMA()
+        self._ctrl_dma = DMA()
+
+    @staticmethod
+    def _pin_id(pin):
+        # Pin objects print as Pin(GPIOn, ...)
+        s = str(pin)
+        start = s.index("GPIO") + 4
+        end = start
+        while s[end].isdigit():
+            end += 1
+        return int(s[start:end])
+
+    def clock(self, freq):
+        # Each state machine spends two cycles per SD clock
+        self._freq = freq
+        self._init_cmd()
+        self._rx_sm = StateMachine(self._sm_base + 1, sdio_rx, freq=2 * freq,
+                                   sideset_base=self.clk, in_base=self.d0, jmp_pin=self.d0)
+        self._tx_sm = StateMachine(self._sm_base + 2, sdio_tx, freq=2 * freq,
+                                   sideset_base=self.clk, in_base=self.d0,
+                                   out_base=self.d0, set_base=self.d0)
+
+    def _init_cmd(self):
+        self._cmd_sm = StateMachine(self._sm_base, sdio_cmd, freq=2 * self._freq,
+                                    sideset_base=self.clk, out_base=self.cmd_pin,
+                                    set_base=self.cmd_pin, in_base=self.cmd_pin,
+                                    jmp_pin=self.cmd_pin)
+        self._cmd_sm.active(1)
+
+    def _wait_dma(self, timeout_ms):
+        start = ticks_ms()
+        while self._ctrl_dma.active() or self._data_dma.active():
+            if ticks_diff(ticks_ms(), start) > timeout_ms:
+                self._ctrl_dma.active(0)
+                self._data_dma.active(0)
+                return False
+        return True
+
+    def command(self, buf, resp, resp_bits=0):
+        sm = self._cmd_sm
+        sm.put((47 << 24) | (buf[0] << 16) | (buf[1] << 8) | buf[2])
+        sm.put((buf[3] << 24) | (buf[4] << 16) | (buf[5] << 8) | ((resp_bits or 1) - 1))
+
+        if resp is None:
+            # Nothing will answer; let the command go out then reset the
+            # state machine out of its wait for a response.
+            start = ticks_ms()
+            while sm.tx_fifo() and ticks_diff(ticks_ms(), start) < _CMD_TIMEOUT_MS:
+                pass
+            sleep_us(64 * 1_000_000 // self._freq)
+            sm.active(0)
+            self._init_cmd()
+            return True
+
+        words = self._resp_words
+        nwords = (resp_bits + 31) // 32
+        start = ticks_ms()
+        for i in range(nwords):
+            while not sm.rx_fifo():
+                if ticks_diff(ticks_ms(), start) > _CMD_TIMEOUT_MS:
+                    sm.active(0)
+                    self._init_cmd()
+                    return False
+            words[i] = sm.get()
+
+        # The last word is only partly filled, right aligned
+        full = resp_bits // 32
+        rem = resp_bits - 32 * full
+        j = 0
+        for i in range(full):
+            w = words[i]
+            resp[j] = w >> 24
+            resp[j + 1] = (w >> 16) & 0xFF
+            resp[j + 2] = (w >> 8) & 0xFF
+            resp[j + 3] = w & 0xFF
+            j += 4
+        w = words[full]
+        for shift in range(rem - 8, -1, -8):
+            resp[j] = (w >> shift) & 0xFF
+            j += 1
+        return True
+
+    def _arm_rx(self):
+        sm = self._rx_sm
+        sm.active(0)
+        sm.restart()
+        while sm.rx_fifo():
+            sm.get()
+        sm.put(_BLOCK_NIBBLES - 1)
+        sm.exec("pull()")
+        sm.exec("out(y, 32)")
+
+    def read(self, buf, nblocks):
+        addr = uctypes.addressof(buf)
+        if not addr & 3:
+            return self._read(addr, nblocks, 0)
+
+        # DMA needs word aligned buffers; go through the bounce buffer a
+        # block at a time instead (the card waits while the clock is stopped)
+        mv = memoryview(buf)
+        bounce = uctypes.addressof(self._bounce)
+        for i in range(nblocks):
+            if not self._read(bounce, 1, i):
+                return False
+            mv[i * 512 : i * 512 + 512] = self._bounce
+        return True
+
+    def _read(self, addr, nblocks, first):
+        descs = self._descs
+        crcs = uctypes.addressof(self._crcs) + 8 * first
+        j = 0
+        for i in range(nblocks):
+            descs[j] = addr + 512 * i
+            descs[j + 1] = _BLOCK_WORDS
+            descs[j + 2] = crcs + 8 * i
+            descs[j + 3] = _CRC_WORDS
+            j += 4
+        descs[j] = 0
+        descs[j + 1] = 0
+
+        self._arm_rx()
+        data_ctrl = self._data_dma.pack_ctrl(size=2, inc_read=False, inc_write=True,
+                                             treq_sel=self._dreq_rx, bswap=True,
+                                             chain_to=self._ctrl_dma.channel)
+        self._data_dma.config(read=self._pio_base + _PIO_RXF0 + 4 * ((self._sm_base + 1) & 3),
+                              ctrl=data_ctrl)
+        ctrl_ctrl = self._ctrl_dma.pack_ctrl(size=2, inc_read=True, inc_write=True,
+                                             ring_size=3, ring_sel=True)
+        self._ctrl_dma.config(read=descs,
+                              write=_DMA_BASE + 0x40 * self._data_dma.channel + _DMA_AL1_WRITE_ADDR,
+                              count=2, ctrl=ctrl_ctrl, trigger=True)
+        self._rx_sm.active(1)
+
+        ok = self._wait_dma(_DATA_TIMEOUT_MS * nblocks)
+        self._rx_sm.active(0)
+        return ok
+
+    def crc(self, i):
+        return memoryview(self._crcs)[i * 8 : i * 8 + 8]
+
+    def stop(self):
+        self._rx_sm.active(0)
+
+    def busy(self):
+        return not self.d0.value()
+
+    def write(self, block, crc, status):
+        addr = uctypes.addressof(block)
+        if addr & 3:
+            self._bounce[:] = block
+            addr = uctypes.addressof(self._bounce)
+
+        descs = self._tx_descs
+        descs[0] = 1
+        descs[1] = uctypes.addressof(self._tx_head)
+        descs[2] = _BLOCK_WORDS
+        descs[3] = addr
+        descs[4] = _CRC_WORDS
+        descs[5] = uctypes.addressof(crc)
+        descs[6] = 1
+        descs[7] = uctypes.addressof(self._tx_tail)
+        descs[8] = 0
+        descs[9] = 0
+
+        sm = self._tx_sm
+        sm.active(0)
+        sm.restart()
+        while sm.rx_fifo():
+            sm.get()
+        sm.put(_TX_NIBBLES - 1)
+        sm.exec("pull()")
+        sm.exec("out(x, 32)")
+
+        data_ctrl = self._data_dma.pack_ctrl(size=2, inc_read=True, inc_write=False,
+                                             treq_sel=self._dreq_tx, bswap=True,
+                                             chain_to=self._ctrl_dma.channel)
+        self._data_dma.config(write=self._pio_base + _PIO_TXF0 + 4 * ((self._sm_base + 2) & 3),
+                              ctrl=data_ctrl)
+        ctrl_ctrl = self._ctrl_dma.pack_ctrl(size=2, inc_read=True, inc_write=True,
+                                             ring_size=3, ring_sel=True)
+        self._ctrl_dma.config(read=descs,
+                              write=_DMA_BASE + 0x40 * self._data_dma.channel + _DMA_AL3_TRANS_COUNT,
+                              count=2, ctrl=ctrl_ctrl, trigger=True)
+        sm.active(1)
+
+        ok = self._wait_dma(_DATA_TIMEOUT_MS)
+        start = ticks_ms()
+        for i in range(2):
+            while ok and not sm.rx_fifo():
+                if ticks_diff(ticks_ms(), start) > _CMD_TIMEOUT_MS:
+                    ok = False
+            if ok:
+                status[i] = sm.get()
+        sm.active(0)
+        return ok
+
+    def crc16(self, data, out):
+        _crc16x4(data, len(data), self._table_hi, self._table_lo, out)
+
+    def crc_matches(self, data, crc):
+        calc = self._crc_calc
+        _crc16x4(data, len(data), self._table_hi, self._table_lo, calc)
+        for i in range(8):
+            if calc[i] != crc[i]:
+                return False
+        return True
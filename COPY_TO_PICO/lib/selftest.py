@@ -0,0 +1,163 @@
+"""
+Panel self-test.
+
+Draws test patterns straight into a frame buffer, in the layout
+png_to_frame.py writes, so a panel can be checked without any frames in
+storage:
+
+    red, green, blue, white   every LED of one color at full level
+    gradient                  16 level ramps, red, green and blue bands
+    checker                   alternate white and black pixels
+    address                   one bar per row address, each a step longer
+                              than the last; a missing, stuck or shorted
+                              address line shows up as a broken staircase
+
+Each pattern is refreshed for a few frames while the feeder is timed.  The
+refresh state machines take a known number of PIO cycles per frame
+(hub75.row_cycles), so any time beyond that was spent with led_data waiting
+on an empty TX FIFO; a pattern passes when that stall is within 'tolerance'
+of the frame time.  Results go to the serial console:
+
+    import selftest
+    selftest.run(led_data_sm, 64, 32, PIO_FREQ)
+
+display.py runs it at start up when SELF_TEST is set, and on its own when
+there are no frames to show.
+"""
+
+from utime import ticks_us, ticks_diff
+import micropython
+import hub75
+
+PLANE_COUNT = hub75.PLANE_COUNT
+LEVELS = 16
+
+
+def level_planes(level):
+    # Planes a level (0-15) is lit in, spread out as 'high_freq' does
+    planes = 0
+    for i in range(level):
+        planes |= 1 << int(PLANE_COUNT / level * i)
+    return planes
+
+
+LEVEL_PLANES = [level_planes(level) for level in range(LEVELS)]
+
+_TOP = LEVELS - 1
+
+
+def red(x, y, width, height):
+    return _TOP, 0, 0
+
+
+def green(x, y, width, height):
+    return 0, _TOP, 0
+
+
+def blue(x, y, width, height):
+    return 0, 0, _TOP
+
+
+def white(x, y, width, height):
+    return _TOP, _TOP, _TOP
+
+
+def gradient(x, y, width, height):
+    level = x * LEVELS // width
+    band = y * 3 // height
+    return (level, 0, 0) if band == 0 else (0, level, 0) if band == 1 else (0, 0, level)
+
+
+def checker(x, y, width, height):
+    return white(x, y, width, height) if (x + y) & 1 else (0, 0, 0)
+
+
+def address(x, y, width, height):
+    half = height // 2
+    row = y % half
+    if x >= (row + 1) * width // half:
+        return 0, 0, 0
+    return ((_TOP, 0, 0), (0, _TOP, 0), (0, 0, _TOP))[row % 3]
+
+
+PATTERNS = (
+    ("red", red),
+    ("green", green),
+    ("blue", blue),
+    ("white", white),
+    ("gradient", gradient),
+    ("checker", checker),
+    ("address", address),
+)
+
+
+@micropython.native
+def fill(frame, width, height, pattern):
+    # Bits 0-2 (B, G, R) come from row 'height - 1 - r', bits 3-5 from
+    # 'half - 1 - r', as png_to_frame.py lays them out
+    half = height // 2
+    plane_bytes = half * width
+    for r in range(half):
+        for c in range(width):
+            red_1, green_1, blue_1 = pattern(c, height - 1 - r, width, height)
+            red_2, green_2, blue_2 = pattern(c, half - 1 - r, width, height)
+            planes = (LEVEL_PLANES[blue_1], LEVEL_PLANES[green_1], LEVEL_PLANES[red_1],
+                      LEVEL_PLANES[blue_2], LEVEL_PLANES[green_2], LEVEL_PLANES[red_2])
+            i = r * width + c
+            for p in range(PLANE_COUNT):
+                value = 0
+                for k in range(6):
+                    value |= ((planes[k] >> p) & 1) << k
+                frame[i] = value
+                i += plane_bytes
+
+
+def run(led_data_sm, width, height, freq, pixel_scale=1, scan_order="sequential", frames=2, tolerance=0.05,
+        feed=None, address_counter_sm=None, timing=None, on_cycles=None):
+    # Shows every pattern and prints its refresh rate and FIFO stall time;
+    # returns True if all of them passed.  'feed' is called after every
+    # frame, to keep a watchdog fed.  Pass address_counter_sm when the
+    # state machines skip dark rows; frames are then timed on the rows sent.
+    # Pass the state machines' ShiftTiming, if they have one, and its freq;
+    # with dim planes, pass address_counter_sm and hub75.plane_on_cycles too
+    # (the patterns leave the dim planes dark)
+    stored_width = width // pixel_scale
+    stored_height = height // pixel_scale
+    planes = PLANE_COUNT if on_cycles is None else len(on_cycles)
+    frame = bytearray(planes * (stored_height // 2) * stored_width)
+    skip_dark_rows = address_counter_sm is not None and on_cycles is None
+    rows = hub75.frame_rows(frame, width, height // 2, pixel_scale, scan_order, in_scan_order=False,
+                            on_cycles=on_cycles)
+    slots = (height // 2) * planes
+
+    failed = []
+    for name, pattern in PATTERNS:
+        fill(frame, stored_width, stored_height, pattern)
+        if skip_dark_rows:
+            rows = hub75.frame_rows(frame, width, height // 2, pixel_scale, scan_order, False, True)
+            slots = sum(len(group) for dark, group in rows)
+        frame_us = hub75.row_cycles(width, pixel_scale, timing) * slots * 1_000_000 // freq
+
+        # One frame to get the new pattern up, then time the rest
+        hub75.put_frame(led_data_sm, frame, rows, address_counter_sm)
+        if feed:
+            feed()
+        start = ticks_us()
+        for _ in range(frames):
+            hub75.put_frame(led_data_sm, frame, rows, address_counter_sm)
+            if feed:
+                feed()
+        elapsed = ticks_diff(ticks_us(), start)
+
+        stall = max(0, elapsed - frames * frame_us) // frames
+        passed = stall <= frame_us * tolerance
+        if not passed:
+            failed.append(name)
+        print("self-test %s: %.2f Hz (expected %.2f Hz), FIFO stall %.1f ms per frame: %s" % (
+            name, frames * 1_000_000 / elapsed, 1_000_000 / frame_us, stall / 1000, "PASS" if passed else "FAIL"))
+
+    if failed:
+        print("self-test FAIL:", ", ".join(failed))
+    else:
+        print("self-test PASS")
+    return not failed
@@ -0,0 +1,120 @@
+"""
+Event trace: timestamped events from both cores in a preallocated ring
+buffer, to see on a timeline why a frame was late (a long read, a feeder
+waiting on the lock, a collection) where counters only say that it was.
+
+Each core has its own ring of 'size' events, two words each (ticks_us, and
+the event with a 22-bit argument), so recording takes no lock and allocates
+nothing; the oldest events are overwritten.  The main thread is taken to run
+on core 0 and the other thread on core 1, as the rp2 port runs them.
+
+    import tracebuf
+    tracebuf.enable(512)                # events per core
+    tracebuf.record(tracebuf.READ_BEGIN)
+    ...
+    if tracebuf.requested():            # a 'd' came in over the serial port
+        tracebuf.dump()
+
+dump() prints the rings as text between a 'trace' line and a 'trace end'
+line, oldest event first; trace_export.py turns the output (saved from a
+serial terminal, or read from the port) into Chrome trace JSON for
+chrome://tracing or ui.perfetto.dev.  record() does nothing until enable().
+"""
+
+from array import array
+from utime import ticks_us
+import _thread
+import sys
+
+READ_BEGIN = 1
+READ_END = 2
+PUBLISH = 3
+SWAP = 4
+STALL_BEGIN = 5
+STALL_END = 6
+GC_BEGIN = 7
+GC_END = 8
+WDT_FEED = 9
+FRAME_IN = 10
+CACHE_HIT = 11
+
+# Name and Chrome trace phase (B begins a span, E ends it, i is an instant)
+EVENTS = {
+    READ_BEGIN: ("read", "B"),
+    READ_END: ("read", "E"),
+    PUBLISH: ("publish", "i"),
+    SWAP: ("swap", "i"),
+    STALL_BEGIN: ("stall", "B"),
+    STALL_END: ("stall", "E"),
+    GC_BEGIN: ("gc", "B"),
+    GC_END: ("gc", "E"),
+    WDT_FEED: ("wdt_feed", "i"),
+    FRAME_IN: ("frame_in", "i"),
+    CACHE_HIT: ("cache_hit", "i"),
+}
+
+ARG_MASK = 0x3FFFFF
+CORES = 2
+
+_size = 0
+_ring = None
+_next = [0] * CORES
+_count = [0] * CORES
+_main = _thread.get_ident()
+_poll = None
+
+
+def enable(size=512):
+    global _size, _ring, _poll
+    _ring = array("L", [0] * (2 * CORES * size))
+    for core in range(CORES):
+        _next[core] = _count[core] = 0
+    _size = size
+    try:
+        import select
+        _poll = select.poll()
+        _poll.register(sys.stdin, select.POLLIN)
+    except (ImportError, AttributeError, OSError):
+        _poll = None
+
+
+def record(event, arg=0):
+    size = _size
+    if size:
+        core = 0 if _thread.get_ident() == _main else 1
+        # The slot is taken before it is written, so a soft IRQ recording in
+        # between writes the next one
+        i = _next[core]
+        _next[core] = i + 1 if i + 1 < size else 0
+        if _count[core] < size:
+            _count[core] += 1
+        j = 2 * (core * size + i)
+        _ring[j] = ticks_us()
+        _ring[j + 1] = event | (arg & ARG_MASK) << 8
+
+
+def requested():
+    # True when a 'd' has come in over the serial port
+    if _poll is None or not _poll.poll(0):
+        return False
+    return sys.stdin.read(1) == "d"
+
+
+def dump():
+    # The rings as text, one event per line: core, ticks_us, name, phase, arg
+    global _size
+    size, _size = _size, 0
+    if not size:
+        print("trace off")
+        return
+    print("trace %d %d %d" % (CORES, size, ticks_us()))
+    for core in range(CORES):
+        count = _count[core]
+        start = _next[core] - count
+        for k in range(count):
+            j = 2 * (core * size + (start + k) % size)
+            word = _ring[j + 1]
+            name, phase = EVENTS.get(word & 0xFF, ("event_%d" % (word & 0xFF), "i"))
+            print("%d %d %s %s %d" % (core, _ring[j], name, phase, word >> 8))
+    print("trace end")
+    _size = size
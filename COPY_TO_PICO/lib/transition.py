@@ -0,0 +1,125 @@
+"""
+Transitions between two frames, made only from the feeder's row list.
+
+Neither frame is copied or re-encoded: each step of a transition is a list
+of row views taken from the outgoing and incoming frames (or a blank row),
+which the feeder sends like any other row list.  led_data takes its bytes
+from the FIFO whatever the put boundaries are, so a panel row can also be
+made of a piece of one frame's row followed by a piece of the other's.
+
+    cut        the new frame straight away
+    crossfade  plane by plane: at step k of n, about 15k/n of the planes
+               come from the new frame.  Levels are spread over the planes
+               (see png_to_frame.py), so each plane carries about 1/15 of
+               every color and the mix is close to a linear blend
+    fade       the same through black: planes of the old frame are blanked,
+               then planes of the new one come in
+    wipe       the new frame wipes in from the left, a column at a time
+    slide      the new frame pushes the old one off to the left
+    dissolve   row pairs switch over in a scattered order
+
+PLANE_MIX_ORDER decides which planes go first, spread out so 'basic'
+modulation (lit planes 0 to level-1) blends as evenly as 'high_freq'.
+
+    steps = transition.Transition("crossfade", 64, 16)
+    steps.begin(old_frame, new_frame)
+    rows = steps.rows(step, 15)        # step 0 is the old frame, 15 the new
+
+display.py runs TRANSITION between the frames it cycles through.  Frames
+compiled with skip_dark_rows vary in layout, so with SKIP_DARK_ROWS set it
+only cuts.
+"""
+
+import hub75
+
+PLANE_COUNT = hub75.PLANE_COUNT
+
+TRANSITIONS = ("cut", "crossfade", "fade", "wipe", "slide", "dissolve")
+
+PLANE_MIX_ORDER = (0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7)
+
+
+class Transition:
+    def __init__(self, kind, width, address_count, pixel_scale=1, scan_order="sequential", in_scan_order=True):
+        if kind not in TRANSITIONS:
+            raise ValueError("transition should be one of %s, not %s" % (", ".join(TRANSITIONS), kind))
+        self.kind = kind
+        self.width = width
+        self.address_count = address_count
+        self.pixel_scale = pixel_scale
+        self.scan_order = scan_order
+        self.in_scan_order = in_scan_order
+        self.row_bytes = width // pixel_scale
+        self.blank = memoryview(bytearray(self.row_bytes))
+        self.slots = hub75.scan_slots(address_count, scan_order)
+
+        self.plane_rank = [0] * PLANE_COUNT
+        for rank, plane in enumerate(PLANE_MIX_ORDER):
+            self.plane_rank[plane] = rank
+
+        # Addresses in a fixed scattered order: a step through them that
+        # shares no factor with the count visits every one
+        step = address_count // 2 + 1
+        while _gcd(step, address_count) != 1:
+            step += 1
+        self.address_rank = [0] * address_count
+        for rank in range(address_count):
+            self.address_rank[(rank * step) % address_count] = rank
+
+        self._old = self._new = None
+
+    def begin(self, old, new):
+        self._old = hub75.slot_views(old, self.width, self.address_count, self.pixel_scale, self.scan_order,
+                                     self.in_scan_order)
+        self._new = hub75.slot_views(new, self.width, self.address_count, self.pixel_scale, self.scan_order,
+                                     self.in_scan_order)
+
+    def rows(self, step, steps):
+        # The row list 'step' of 'steps' of the way from the old frame to the new
+        old, new = self._old, self._new
+        kind = self.kind
+        if step <= 0:
+            return list(old)
+        if kind == "cut" or step >= steps:
+            return list(new)
+
+        rows = []
+        if kind in ("wipe", "slide"):
+            split = self.row_bytes * step // steps
+            for old_row, new_row in zip(old, new):
+                if kind == "wipe":
+                    _append_parts(rows, new_row[:split], old_row[split:])
+                else:
+                    _append_parts(rows, old_row[split:], new_row[:split])
+            return rows
+
+        if kind == "crossfade":
+            mixed = PLANE_COUNT * step // steps
+            for i, (plane, address) in enumerate(self.slots):
+                rows.append(new[i] if self.plane_rank[plane] < mixed else old[i])
+        elif kind == "fade":
+            # First half: the old frame's planes go dark, second half: the new frame's come in
+            if 2 * step < steps:
+                frame, shown = old, PLANE_COUNT - PLANE_COUNT * 2 * step // steps
+            else:
+                frame, shown = new, PLANE_COUNT * (2 * step - steps) // steps
+            for i, (plane, address) in enumerate(self.slots):
+                rows.append(frame[i] if self.plane_rank[plane] < shown else self.blank)
+        else:
+            switched = self.address_count * step // steps
+            for i, (plane, address) in enumerate(self.slots):
+                rows.append(new[i] if self.address_rank[address] < switched else old[i])
+        return rows
+
+
+def _append_parts(rows, first, second):
+    if len(first):
+        rows.append(first)
+    if len(second):
+        rows.append(second)
+
+
+def _gcd(a, b):
+    while b:
+        a, b = b, a % b
+    return a
@@ -0,0 +1,107 @@
+"""
+Zone layouts: the panel split into rectangular zones (a static logo, a price
+block that changes every minute, a ticker that moves twice a second), each
+showing its own images at its own interval, as zone_compiler.py compiles
+them from 'zones.ini'.
+
+A zone's image is stored as a patch: only the frame bytes, in every plane,
+that show the zone's pixels, in frame order, and of those only the bits that
+do (a byte carries a pixel of the top half in bits 3-5 and one of the bottom
+half in bits 0-2, which can belong to different zones).  The layout lists
+each zone's bytes as runs of (start, count, keep): keep is 0 where the zone
+owns the whole byte, so the run is a copy, and the other zone's bits where
+it does not, which are kept as they were.  Updating a zone reads and writes
+just its patch, so storage reads and CPU time follow the zones that change,
+not the whole panel.
+
+    layout = zones.Layout("/zones/layout.json")
+    for zone in layout.zones:
+        if zone.due(now):
+            zone.apply(frame, read(zone.advance(now)))
+    sleep_ms(layout.wait_ms(now, longest))
+
+Patches are written into a frame in place, so the frame's row list (which
+only holds views of it) stays as it is.  A zone with interval 0 is shown
+once and never changes.
+"""
+
+from array import array
+from utime import ticks_diff, ticks_add
+import json
+import micropython
+
+
+@micropython.viper
+def _apply(frame, patch, runs, run_count: int):
+    out = ptr8(frame)
+    data = ptr8(patch)
+    run = ptr32(runs)
+    o = 0
+    for k in range(run_count):
+        start = run[3 * k]
+        count = run[3 * k + 1]
+        keep = run[3 * k + 2]
+        for i in range(start, start + count):
+            out[i] = (out[i] & keep) | data[o]
+            o += 1
+
+
+class Zone:
+    def __init__(self, name, interval, runs, paths):
+        if len(runs) % 3 or not paths:
+            raise ValueError("zone '%s' needs runs of (start, count, keep) and at least one patch" % name)
+        self.name = name
+        # In ms; 0 for a zone that never changes
+        self.interval = interval
+        self.runs = array("i", runs)
+        self.run_count = len(runs) // 3
+        self.patch_size = sum(runs[1::3])
+        self.paths = paths
+        self.index = 0
+        self.next_update = None
+        self.updates = 0
+
+    def due(self, now):
+        if self.next_update is None:
+            return True
+        return self.interval and ticks_diff(self.next_update, now) <= 0
+
+    def advance(self, now):
+        # The path of the zone's next patch; updates are kept on their
+        # schedule, unless they have fallen a whole interval behind
+        path = self.paths[self.index]
+        self.index = (self.index + 1) % len(self.paths)
+        if self.next_update is None or ticks_diff(now, self.next_update) >= self.interval:
+            self.next_update = now
+        self.next_update = ticks_add(self.next_update, self.interval)
+        self.updates += 1
+        return path
+
+    def apply(self, frame, patch):
+        if len(patch) != self.patch_size:
+            raise ValueError("zone '%s' patches are %d bytes, not %d" % (self.name, self.patch_size, len(patch)))
+        _apply(frame, patch, self.runs, self.run_count)
+
+
+class Layout:
+    def __init__(self, path):
+        with open(path) as layout_file:
+            layout = json.load(layout_file)
+        # Patch paths are relative to the layout file
+        base = path.rsplit("/", 1)[0] + "/" if "/" in path else ""
+        self.frame_size = layout["frame_size"]
+        self.zones = [Zone(zone["name"], zone["interval"], zone["runs"], [base + name for name in zone["patches"]])
+                      for zone in layout["zones"]]
+        for zone in self.zones:
+            if zone.runs and zone.runs[-3] + zone.runs[-2] > self.frame_size:
+                raise ValueError("zone '%s' runs past the %d byte frame" % (zone.name, self.frame_size))
+
+    def wait_ms(self, now, longest):
+        # Until the next zone is due, at most longest
+        wait = longest
+        for zone in self.zones:
+            if zone.next_update is None:
+                return 0
+            if zone.interval:
+                wait = min(wait, max(0, ticks_diff(zone.next_update, now)))
+        return wait
@@ -0,0 +1,131 @@
+/*
+ * Compiled inner loop for frame_compiler.FrameCompiler.
+ *
+ * Goes from an 8-bit image straight to the subframe-major output: every
+ * channel value is looked up in a table of plane codes (bit p set if the
+ * channel is lit in plane p), then the (channel x plane) bit matrix of each
+ * pixel is transposed so that each plane gets one byte per pixel holding one
+ * bit per channel.  The transpose is done 16 or 32 pixels at a time with
+ * SSE2/AVX2, with a plain loop for other targets.
+ *
+ * Build with 'python bitplane_kernel.py build', or by hand:
+ *     cc -O3 -march=native -shared -fPIC bitplane_kernel.c -o _bitplane_kernel.so
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LANES 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LANES 16
+#else
+#define LANES 16
+#endif
+
+#define CHANNELS 6
+#define MAX_PLANES 16
+
+/* One group of LANES pixels: all planes for the output bits of every channel */
+static void transpose_group(uint8_t codes[2][CHANNELS][LANES], int planes,
+                            uint8_t *out, size_t plane_stride, int count)
+{
+    for (int p = 0; p < planes; p++) {
+        uint8_t (*bytes)[LANES] = codes[p >> 3];
+        int shift = p & 7;
+        uint8_t *dst = out + (size_t)p * plane_stride;
+
+#if defined(__AVX2__)
+        const __m256i one = _mm256_set1_epi8(1);
+        const __m128i count_p = _mm_cvtsi32_si128(shift);
+        __m256i acc = _mm256_setzero_si256();
+        for (int k = 0; k < CHANNELS; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)bytes[k]);
+            /* 16-bit shifts are fine: the mask drops whatever crosses a byte */
+            v = _mm256_and_si256(_mm256_srl_epi16(v, count_p), one);
+            acc = _mm256_or_si256(acc, _mm256_sll_epi16(v, _mm_cvtsi32_si128(k)));
+        }
+        if (count == LANES) {
+            _mm256_storeu_si256((__m256i *)dst, acc);
+        } else {
+            uint8_t tmp[LANES];
+            _mm256_storeu_si256((__m256i *)tmp, acc);
+            memcpy(dst, tmp, count);
+        }
+#elif defined(__SSE2__)
+        const __m128i one = _mm_set1_epi8(1);
+        const __m128i count_p = _mm_cvtsi32_si128(shift);
+        __m128i acc = _mm_setzero_si128();
+        for (int k = 0; k < CHANNELS; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)bytes[k]);
+            v = _mm_and_si128(_mm_srl_epi16(v, count_p), one);
+            acc = _mm_or_si128(acc, _mm_sll_epi16(v, _mm_cvtsi32_si128(k)));
+        }
+        if (count == LANES) {
+            _mm_storeu_si128((__m128i *)dst, acc);
+        } else {
+            uint8_t tmp[LANES];
+            _mm_storeu_si128((__m128i *)tmp, acc);
+            memcpy(dst, tmp, count);
+        }
+#else
+        for (int i = 0; i < count; i++) {
+            uint8_t acc = 0;
+            for (int k = 0; k < CHANNELS; k++)
+                acc |= ((bytes[k][i] >> shift) & 1) << k;
+            dst[i] = acc;
+        }
+#endif
+    }
+}
+
+/*
+ * image:   height x width x 3, row-major, contiguous
+ * sources: CHANNELS (half, channel) pairs; output bit k comes from channel
+ *          sources[2k + 1] of the top (0) or bottom (1) half
+ * lut:     256 plane codes
+ * out:     planes x (height / 2) x width bytes
+ *
+ * Rows are taken bottom to top within each half, as the panel addresses them.
+ * Returns 0, or -1 if the arguments are out of range.
+ */
+int bitplane_compile(const uint8_t *image, int height, int width,
+                     const uint8_t *sources, const uint16_t *lut, int planes,
+                     uint8_t *out)
+{
+    if (height <= 0 || height % 2 || width <= 0 || planes <= 0 || planes > MAX_PLANES)
+        return -1;
+
+    int half = height / 2;
+    size_t row_bytes = (size_t)width * 3;
+    size_t plane_stride = (size_t)half * width;
+    uint8_t codes[2][CHANNELS][LANES];
+
+    memset(codes, 0, sizeof(codes));
+
+    for (int r = 0; r < half; r++) {
+        const uint8_t *rows[2] = {
+            image + (size_t)(height - 1 - r) * row_bytes,
+            image + (size_t)(half - 1 - r) * row_bytes,
+        };
+
+        for (int c0 = 0; c0 < width; c0 += LANES) {
+            int count = width - c0 < LANES ? width - c0 : LANES;
+
+            for (int k = 0; k < CHANNELS; k++) {
+                const uint8_t *src = rows[sources[2 * k]] + (size_t)c0 * 3 + sources[2 * k + 1];
+                for (int i = 0; i < count; i++) {
+                    uint16_t code = lut[src[3 * i]];
+                    codes[0][k][i] = (uint8_t)code;
+                    codes[1][k][i] = (uint8_t)(code >> 8);
+                }
+            }
+
+            transpose_group(codes, planes, out + (size_t)r * width + c0, plane_stride, count);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+import argparse
+import ctypes
+import os
+import subprocess
+import sys
+import time
+import numpy as np
+
+'''
+
+Optional compiled kernel for 'frame_compiler.py' (source in 'bitplane_kernel.c').
+
+FrameCompiler uses it automatically once it has been built, and falls back to
+its numpy path otherwise; both give identical bytes.
+
+    python bitplane_kernel.py build        compile _bitplane_kernel.so with the system C compiler
+    python bitplane_kernel.py benchmark    time the kernel against the numpy path
+
+
+'''
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+SOURCE_PATH = os.path.join(SCRIPT_DIR, 'bitplane_kernel.c')
+LIBRARY_PATH = os.path.join(SCRIPT_DIR, '_bitplane_kernel.so')
+
+_library = None
+
+
+def load():
+    # Returns the kernel library, or None if it has not been built
+    global _library
+    if _library is None and os.path.exists(LIBRARY_PATH):
+        try:
+            library = ctypes.CDLL(LIBRARY_PATH)
+        except OSError:
+            return None
+        library.bitplane_compile.argtypes = [
+            ctypes.c_void_p, ctypes.c_int, ctypes.c_int,
+            ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p,
+        ]
+        library.bitplane_compile.restype = ctypes.c_int
+        _library = library
+    return _library
+
+
+class Kernel:
+    # Holds the kernel's argument buffers for one FrameCompiler, so calls
+    # only pass pointers
+    def __init__(self, library, sources, codes):
+        self._compile = library.bitplane_compile
+        self._sources = np.array(sources, dtype=np.uint8).ravel()
+        self._lut = np.ascontiguousarray(codes, dtype=np.uint16)
+        self._sources_ptr = self._sources.ctypes.data
+        self._lut_ptr = self._lut.ctypes.data
+
+    def compile(self, image, planes, out):
+        height, width = image.shape[:2]
+        result = self._compile(image.ctypes.data, height, width, self._sources_ptr,
+                               self._lut_ptr, planes, out.ctypes.data)
+        if result:
+            raise ValueError('bitplane kernel rejected its arguments')
+
+
+def build(compiler=None, flags=('-O3', '-march=native')):
+    compiler = compiler or os.environ.get('CC', 'cc')
+    command = [compiler, *flags, '-shared', '-fPIC', SOURCE_PATH, '-o', LIBRARY_PATH]
+    print(' '.join(command))
+    subprocess.run(command, check=True)
+
+
+def time_per_frame(function, seconds=0.5):
+    function()
+    count = 0
+    start = time.perf_counter()
+    while time.perf_counter() - start < seconds:
+        function()
+        count += 1
+    return (time.perf_counter() - start) / count
+
+
+def benchmark(sizes, modulation, source_size):
+    from frame_compiler import FrameCompiler
+
+    if load() is None:
+        print("Kernel not built, run 'python bitplane_kernel.py build' first.")
+        return 1
+
+    rng = np.random.default_rng(0)
+    print(f"{'panel':>10} {'frame bytes':>12} {'numpy':>10} {'kernel':>10} {'speedup':>8}")
+    for width, height in sizes:
+        image = rng.integers(0, 256, (height, width, 3), dtype=np.uint8)
+        fast = FrameCompiler(height, width, modulation)
+        slow = FrameCompiler(height, width, modulation, use_kernel=False)
+        out_fast = bytearray(fast.frame_size)
+        out_slow = bytearray(slow.frame_size)
+        numpy_time = time_per_frame(lambda: slow.compile_frame(image, out_slow))
+        kernel_time = time_per_frame(lambda: fast.compile_frame(image, out_fast))
+        if out_fast != out_slow:
+            print(f'{width}x{height}: kernel and numpy output differ')
+            return 1
+        print(f'{f"{width}x{height}":>10} {fast.frame_size:>12} {numpy_time * 1e3:>8.3f}ms '
+              f'{kernel_time * 1e3:>8.3f}ms {numpy_time / kernel_time:>7.1f}x')
+
+    if source_size:
+        # Whole per-frame cost of transcoding a large source: resize + compile
+        source_width, source_height = source_size
+        source = rng.integers(0, 256, (source_height, source_width, 3), dtype=np.uint8)
+        for width, height in sizes:
+            fast = FrameCompiler(height, width, modulation)
+            out = bytearray(fast.frame_size)
+            total = time_per_frame(lambda: fast.compile_frame(fast.resize(source), out))
+            print(f'{source_width}x{source_height} -> {width}x{height}: {total * 1e3:.2f}ms per frame, {1 / total:.0f} fps')
+    return 0
+
+
+def parse_size(text):
+    width, _, height = text.lower().partition('x')
+    return int(width), int(height)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Build or benchmark the compiled bitplane kernel.')
+    commands = parser.add_subparsers(dest='command', required=True)
+    build_parser = commands.add_parser('build')
+    build_parser.add_argument('--cc', default=None, help='C compiler (default $CC or cc)')
+    build_parser.add_argument('--portable', action='store_true', help='build without -march=native')
+    bench_parser = commands.add_parser('benchmark')
+    bench_parser.add_argument('--sizes', type=parse_size, nargs='+',
+                              default=[(64, 32), (128, 64), (256, 128), (512, 256)])
+    bench_parser.add_argument('--modulation', default='high_freq')
+    bench_parser.add_argument('--source-size', type=parse_size, default=(3840, 2160),
+                              help='also time resizing from this size, 0x0 to skip')
+    args = parser.parse_args(argv)
+
+    if args.command == 'build':
+        build(args.cc, ('-O3',) if args.portable else ('-O3', '-march=native'))
+        return 0
+    return benchmark(args.sizes, args.modulation, args.source_size if all(args.source_size) else None)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,422 @@
+import argparse
+import sys
+import time
+import numpy as np
+
+import bitplane_kernel
+
+'''
+
+The frame compiler as a library: turns an RGB image at the panel's resolution
+into the HUB-75 bytes that 'COPY_TO_PICO/display.py' shifts out.
+
+    compiler = FrameCompiler(height=32, width=64)
+    frame = compiler.compile_frame(image)           # memoryview, reused
+    compiler.compile_frame(image, out=my_buffer)    # or into your own buffer
+
+The output is PLANE_COUNT subframes, each holding one byte per column for
+every row of the top half; bits 0-2 are the top half's B, G, R and bits 3-5 the
+bottom half's, for the row addressed from the bottom of each half.  With a
+scan_order other than 'sequential' the same rows come in the order the Pico
+shows them in with that SCAN_ORDER (see 'COPY_TO_PICO/lib/hub75.py').
+
+With skip_dark_rows, for a Pico set to SKIP_DARK_ROWS, the frame starts with
+a little endian 32-bit word of dark bits per group of row slots (a plane, or
+for 'row_planes' an address), bit n set when the group's n-th slot lights
+nothing, and only the lit rows follow, so frames vary in size up to
+frame_size.  compile_frame returns just the bytes used.
+
+With dim_planes (1 to DIM_PLANES_MAX), for a Pico set to the same
+DIM_PLANES, the PLANE_COUNT planes hold the top four bits of each channel
+and the frame has dim_planes more after them, one for each next lower
+bit.  The Pico shows those for a whole row but with OE cut to 1/2, 1/4,
+... of a full plane's time, so a channel gets 4 + dim_planes bits from
+PLANE_COUNT + dim_planes row slots (plane_weights gives each plane's
+weight).  Not with skip_dark_rows or the 'row_planes' scan order.
+
+Nothing is allocated per frame: the lookup tables and scratch space are built
+once per compiler, and every step writes into them.  If the compiled kernel
+has been built ('python bitplane_kernel.py build') it does the whole encode in
+one pass; otherwise numpy does it a channel at a time.
+
+Run as a script to compile a stream of raw rgb24 frames (such as the output
+of 'ffmpeg -f rawvideo -pix_fmt rgb24') from stdin, or a file or named pipe,
+into back-to-back encoded frames on stdout.  Writes block when the reader
+falls behind, so the reader's pace is pushed back up the pipe.  Video much
+bigger than the panel is best scaled down by ffmpeg ('-vf
+scale=64:32:flags=area', and '-lowres' for decoders that can decode at
+reduced size), so full size frames are neither decoded nor piped.
+
+
+'''
+
+PLANE_COUNT = 15
+DIM_PLANES_MAX = 4
+# Plane counts a progressively sent frame can be shown at before it is whole
+PROGRESSIVE_STAGES = (1, 3, 5)
+COLOR_MODULATION_MODES = ('high_freq', 'basic')
+SCAN_ORDERS = ('sequential', 'interleaved', 'row_planes')
+
+
+def encode(color_value, mode):
+    # Which of the PLANE_COUNT subframes a color level (0-17) is lit in
+    if mode == 'high_freq':
+        if color_value > 0:
+            index_scalar = PLANE_COUNT / color_value
+            true_indices = [int(index_scalar * i) for i in range(color_value)]
+            return [1 if (i in true_indices) else 0 for i in range(PLANE_COUNT)]
+        return [0] * PLANE_COUNT
+
+    if mode == 'basic':
+        return [1 if (color_value > i) else 0 for i in range(PLANE_COUNT)]
+
+    raise ValueError(f"'COLOR_MODULATION_MODE' should be of type 'string' with a value of either 'basic' or 'high_freq', not '{str(mode)}'.")
+
+
+def scan_slots(address_count, scan_order='sequential', planes=PLANE_COUNT):
+    # (plane, address) of every row slot in the order shown; mirrors
+    # hub75.scan_slots on the Pico
+    if scan_order not in SCAN_ORDERS:
+        raise ValueError(f"'SCAN_ORDER' should be one of {', '.join(SCAN_ORDERS)}, not '{str(scan_order)}'.")
+    bits = max(1, (address_count - 1).bit_length())
+    counts = range(address_count - 1, -1, -1)
+    if scan_order == 'interleaved':
+        addresses = [((count << 1) | (count >> (bits - 1))) & (address_count - 1) for count in counts]
+    else:
+        addresses = list(counts)
+    if scan_order == 'row_planes':
+        return [(plane, address) for address in addresses for plane in range(planes)]
+    return [(plane, address) for plane in range(planes) for address in addresses]
+
+
+def dark_group_size(address_count, scan_order='sequential'):
+    # Row slots covered by each word of dark bits; mirrors hub75.dark_group_size
+    return PLANE_COUNT if scan_order == 'row_planes' else address_count
+
+
+def modulation_table(mode, dim_planes=0):
+    # (PLANE_COUNT + dim_planes, 256) table of which subframes each 8-bit
+    # channel value is lit in
+    if dim_planes:
+        levels = [encode(value >> 4, mode) + [(value >> (3 - bit)) & 1 for bit in range(dim_planes)]
+                  for value in range(256)]
+    else:
+        levels = [encode(value // 15, mode) for value in range(256)]
+    return np.array(levels, dtype=np.uint8).T.copy()
+
+
+def plane_weights(dim_planes=0):
+    # How long each plane is lit, in full planes
+    return np.array([1.0] * PLANE_COUNT + [0.5 ** (bit + 1) for bit in range(dim_planes)])
+
+
+class FrameCompiler:
+    def __init__(self, height=32, width=64, modulation='high_freq', channel_order='rgb', use_kernel=True,
+                 scan_order='sequential', skip_dark_rows=False, dim_planes=0):
+        if height % 2:
+            raise ValueError(f"'height' should be even, not {height}.")
+        if not 0 <= dim_planes <= DIM_PLANES_MAX:
+            raise ValueError(f"'dim_planes' should be 0 to {DIM_PLANES_MAX}, not {dim_planes}.")
+        if dim_planes and (skip_dark_rows or scan_order == 'row_planes'):
+            raise ValueError("'dim_planes' does not work with skip_dark_rows or the 'row_planes' scan order.")
+        if channel_order not in ('rgb', 'bgr'):
+            raise ValueError(f"'channel_order' should be 'rgb' or 'bgr', not '{channel_order}'.")
+
+        self.height = height
+        self.width = width
+        self.channel_order = channel_order
+        self.half_height = height // 2
+        self.planes = PLANE_COUNT + dim_planes
+        self.frame_size = self.planes * self.half_height * width
+
+        # Output bit k comes from (half, channel); the panel takes B, G, R
+        blue, green, red = (2, 1, 0) if channel_order == 'rgb' else (0, 1, 2)
+        self._sources = [(0, blue), (0, green), (0, red), (1, blue), (1, green), (1, red)]
+
+        bits = modulation_table(modulation, dim_planes)
+        self._tables = [np.ascontiguousarray(bits << k) for k in range(6)]
+
+        # The kernel's table holds 16 planes a value
+        library = bitplane_kernel.load() if use_kernel and self.planes <= 16 else None
+        if library is not None:
+            codes = (bits.astype(np.uint16) << np.arange(self.planes, dtype=np.uint16)[:, None]).sum(axis=0)
+            self._kernel = bitplane_kernel.Kernel(library, self._sources, codes)
+        else:
+            self._kernel = None
+
+        # Rows in the order they are sent, as indices into the sequential layout
+        if scan_order == 'sequential':
+            self._row_order = None
+        else:
+            self._row_order = np.array([plane * self.half_height + self.half_height - 1 - address
+                                        for plane, address in scan_slots(self.half_height, scan_order, self.planes)],
+                                       dtype=np.intp)
+            self._sequential = np.empty((self.planes, self.half_height, width), dtype=np.uint8)
+        self.scan_order = scan_order
+
+        self.skip_dark_rows = skip_dark_rows
+        if skip_dark_rows:
+            slots = PLANE_COUNT * self.half_height
+            group_size = dark_group_size(self.half_height, scan_order)
+            self._rows = np.empty((slots, width), dtype=np.uint8)
+            self._lit = np.empty(slots, dtype=bool)
+            self._dark = np.empty(slots, dtype=bool)
+            self._dark_groups = self._dark.reshape(-1, group_size)
+            self._dark_weights = (1 << np.arange(group_size, dtype=np.uint64)).astype(np.uint32)
+            self.dark_bits_size = 4 * (slots // group_size)
+            self.frame_size += self.dark_bits_size
+
+        self._indices = np.empty((self.half_height, width), dtype=np.intp)
+        self._plane = np.empty((self.planes, self.half_height, width), dtype=np.uint8)
+        self._frame = np.empty(self.frame_size, dtype=np.uint8)
+        self._resized = np.empty((height, width, 3), dtype=np.uint8)
+        # Halved copies of large sources on the way down, by size
+        self._halves = {}
+
+    def resize(self, image):
+        # Area-averages an image of any size down to the panel; the result is
+        # only valid until the next call.  Large sources are first halved,
+        # exactly, while still at least four times the panel: OpenCV's 2x
+        # area path is several times faster than its general one, and the
+        # last step then has a small image to average.  The result is
+        # within 10 of a single pass on hard edges, less than one of the
+        # panel's brightness levels (bitplane_kernel.py benchmark times it)
+        if image.shape[:2] == (self.height, self.width):
+            return image
+        import cv2 as cv
+        while (image.shape[0] % 2 == 0 and image.shape[1] % 2 == 0 and
+               image.shape[0] >= 4 * self.height and image.shape[1] >= 4 * self.width):
+            half = (image.shape[0] // 2, image.shape[1] // 2)
+            if half not in self._halves:
+                self._halves[half] = np.empty(half + image.shape[2:], dtype=image.dtype)
+            image = cv.resize(image, half[::-1], dst=self._halves[half], interpolation=cv.INTER_AREA)
+        cv.resize(image, (self.width, self.height), dst=self._resized, interpolation=cv.INTER_AREA)
+        return self._resized
+
+    def compile_frame(self, image, out=None):
+        if image.shape != (self.height, self.width, 3):
+            raise ValueError(f'expected a {self.height}x{self.width}x3 image, not {"x".join(map(str, image.shape))}')
+
+        target = self._frame if out is None else np.frombuffer(out, dtype=np.uint8)
+        if target.size != self.frame_size:
+            raise ValueError(f'output buffer should be {self.frame_size} bytes, not {target.size}')
+
+        rows = self._rows if self.skip_dark_rows else target.reshape(-1, self.width)
+        if self._row_order is None:
+            self._compile_planes(image, rows.reshape(self.planes, self.half_height, self.width))
+        else:
+            self._compile_planes(image, self._sequential)
+            np.take(self._sequential.reshape(-1, self.width), self._row_order, axis=0, out=rows)
+        if self.skip_dark_rows:
+            return self._pack_lit_rows(target)
+        return memoryview(target)
+
+    def _pack_lit_rows(self, target):
+        np.any(self._rows, axis=1, out=self._lit)
+        # The Pico always needs one row to latch, or the last row of the
+        # frame before would stay lit
+        if not self._lit.any():
+            self._lit[0] = True
+        np.logical_not(self._lit, out=self._dark)
+        np.matmul(self._dark_groups, self._dark_weights, out=target[:self.dark_bits_size].view('<u4'))
+        end = self.dark_bits_size + np.count_nonzero(self._lit) * self.width
+        np.compress(self._lit, self._rows, axis=0,
+                    out=target[self.dark_bits_size:end].reshape(-1, self.width))
+        return memoryview(target)[:end]
+
+    def _compile_planes(self, image, planes):
+        if self._kernel is not None and image.dtype == np.uint8 and image.flags.c_contiguous:
+            self._kernel.compile(image, self.planes, planes)
+            return
+
+        # Rows run bottom to top within each half
+        flipped = image[::-1]
+        halves = (flipped[:self.half_height], flipped[self.half_height:])
+
+        indices = self._indices
+        plane = self._plane
+        for k, (half, channel) in enumerate(self._sources):
+            np.copyto(indices, halves[half][:, :, channel])
+            if k == 0:
+                np.take(self._tables[k], indices, axis=1, out=planes, mode='clip')
+            else:
+                np.take(self._tables[k], indices, axis=1, out=plane, mode='clip')
+                np.bitwise_or(planes, plane, out=planes)
+
+
+_compilers = {}
+
+
+def compile_frame(image, out=None, modulation='high_freq', channel_order='rgb'):
+    # Convenience wrapper keeping one FrameCompiler per shape and mode
+    key = (image.shape[0], image.shape[1], modulation, channel_order)
+    compiler = _compilers.get(key)
+    if compiler is None:
+        compiler = _compilers[key] = FrameCompiler(image.shape[0], image.shape[1], modulation, channel_order)
+    return compiler.compile_frame(image, out)
+
+
+def reduce_planes(frame, planes):
+    # A full sequential frame as one of fewer planes (a divisor of
+    # PLANE_COUNT), for a link too slow for full frames: each color bit is
+    # lit in the first round(n * planes / PLANE_COUNT) planes, n being the
+    # number of full planes it was lit in.  The Pico shows every plane
+    # PLANE_COUNT / planes times, so levels keep their brightness to within
+    # a step of the fewer planes
+    if PLANE_COUNT % planes:
+        raise ValueError(f'planes should divide {PLANE_COUNT}, not {planes}')
+    if planes == PLANE_COUNT:
+        return bytes(frame)
+    full = np.frombuffer(frame, dtype=np.uint8).reshape(PLANE_COUNT, -1)
+    shifts = np.arange(6, dtype=np.uint8)
+    counts = ((full[:, :, None] >> shifts) & 1).sum(axis=0, dtype=np.int32)
+    lit = (2 * counts * planes + PLANE_COUNT) // (2 * PLANE_COUNT)
+    bits = (np.arange(planes)[:, None, None] < lit[None]).astype(np.uint8)
+    return (bits << shifts).sum(axis=2, dtype=np.uint8).tobytes()
+
+
+def progressive_planes(frame, planes=PLANE_COUNT):
+    # A sequential frame of 'planes' planes (PLANE_COUNT or a divisor of it)
+    # re-encoded for progressive sending: each color bit is lit in as many
+    # planes as before, but its first k planes, for every k in
+    # PROGRESSIVE_STAGES below 'planes', hold round(n * k / planes) of them,
+    # so a receiver can show the first planes to arrive as a k-plane frame
+    # (as reduce_planes would make it) and refine it as the rest land.
+    # Within each stage the lit planes are spread evenly
+    if PLANE_COUNT % planes:
+        raise ValueError(f'planes should divide {PLANE_COUNT}, not {planes}')
+    full = np.frombuffer(frame, dtype=np.uint8).reshape(planes, -1)
+    shifts = np.arange(6, dtype=np.uint8)
+    counts = ((full[:, :, None] >> shifts) & 1).sum(axis=0, dtype=np.int32)
+    bits = np.zeros((planes,) + counts.shape, dtype=np.uint8)
+    start = lit_before = 0
+    for end in [stage for stage in PROGRESSIVE_STAGES if stage < planes] + [planes]:
+        lit = (2 * counts * end + planes) // (2 * planes)
+        new = lit - lit_before
+        span = np.arange(end - start)[:, None, None]
+        bits[start:end] = (span + 1) * new[None] // (end - start) > span * new[None] // (end - start)
+        start, lit_before = end, lit
+    return (bits << shifts).sum(axis=2, dtype=np.uint8).tobytes()
+
+
+def read_frame(stream, buffer):
+    # Fills buffer from stream; False on a clean end of stream
+    view = memoryview(buffer)
+    got = 0
+    while got < len(view):
+        count = stream.readinto(view[got:])
+        if not count:
+            if got:
+                raise EOFError(f'stream ended {got} bytes into a {len(view)} byte frame')
+            return False
+        got += count
+    return True
+
+
+def write_frame(stream, frame):
+    # Blocks until the whole frame is taken, which is what pushes back on the producer
+    view = memoryview(frame)
+    sent = 0
+    while sent < len(view):
+        count = stream.write(view[sent:])
+        sent += count if count is not None else 0
+
+
+class Throughput:
+    def __init__(self, frame_in, frame_out, interval, log=sys.stderr):
+        self.frame_in = frame_in
+        self.frame_out = frame_out
+        self.interval = interval
+        self.log = log
+        self.start = self.last = time.perf_counter()
+        self.frames = self.last_frames = 0
+        self.waiting_in = self.compiling = self.waiting_out = 0.0
+
+    def report(self, frames, elapsed, final=False):
+        busy = self.waiting_in + self.compiling + self.waiting_out or 1.0
+        fps = frames / elapsed if elapsed else 0.0
+        print(f"{'total' if final else 'stream'}: {self.frames} frames, {fps:.1f} fps, "
+              f"in {fps * self.frame_in / 1e6:.2f} MB/s, out {fps * self.frame_out / 1e6:.2f} MB/s, "
+              f"waiting on input {100 * self.waiting_in / busy:.0f}%, compiling {100 * self.compiling / busy:.0f}%, "
+              f"blocked on output {100 * self.waiting_out / busy:.0f}%", file=self.log)
+
+    def tick(self, now):
+        self.frames += 1
+        if self.interval and now - self.last >= self.interval:
+            self.report(self.frames - self.last_frames, now - self.last)
+            self.last, self.last_frames = now, self.frames
+
+    def finish(self):
+        now = time.perf_counter()
+        self.report(self.frames, now - self.start, final=True)
+
+
+def stream(compiler, source, sink, input_size, report_interval=1.0, max_frames=None):
+    input_width, input_height = input_size
+    raw = np.empty((input_height, input_width, 3), dtype=np.uint8)
+    out = bytearray(compiler.frame_size)
+    stats = Throughput(raw.nbytes, len(out), report_interval)
+
+    while max_frames is None or stats.frames < max_frames:
+        t0 = time.perf_counter()
+        if not read_frame(source, raw):
+            break
+        t1 = time.perf_counter()
+        compiler.compile_frame(compiler.resize(raw), out)
+        t2 = time.perf_counter()
+        write_frame(sink, out)
+        t3 = time.perf_counter()
+        stats.waiting_in += t1 - t0
+        stats.compiling += t2 - t1
+        stats.waiting_out += t3 - t2
+        stats.tick(t3)
+
+    stats.finish()
+    return stats.frames
+
+
+def parse_size(text):
+    width, _, height = text.lower().partition('x')
+    return int(width), int(height)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Compile a stream of raw frames into HUB-75 frames.')
+    parser.add_argument('--input', default='-', help="raw frame source, file or named pipe ('-' for stdin)")
+    parser.add_argument('--output', default='-', help="encoded frame sink, file or named pipe ('-' for stdout)")
+    parser.add_argument('--input-size', type=parse_size, default=(64, 32), help='WIDTHxHEIGHT of the incoming frames')
+    parser.add_argument('--panel-size', type=parse_size, default=(64, 32), help='WIDTHxHEIGHT of the LED matrix')
+    parser.add_argument('--pixel-scale', type=int, default=1,
+                        help='store frames at 1/N of the panel size, for the Pico to show each pixel as an NxN block')
+    parser.add_argument('--scan-order', choices=SCAN_ORDERS, default='sequential',
+                        help="row order the Pico's SCAN_ORDER is set to (full resolution frames only)")
+    parser.add_argument('--pix-fmt', choices=('rgb24', 'bgr24'), default='rgb24')
+    parser.add_argument('--modulation', choices=COLOR_MODULATION_MODES, default='high_freq')
+    parser.add_argument('--dim-planes', type=int, default=0,
+                        help=f"lower bits shown in OE-dimmed planes, 0 to {DIM_PLANES_MAX} (the Pico's DIM_PLANES)")
+    parser.add_argument('--frames', type=int, default=None, help='stop after this many frames')
+    parser.add_argument('--report', type=float, default=1.0, help='seconds between throughput reports, 0 for none')
+    args = parser.parse_args(argv)
+
+    panel_width, panel_height = args.panel_size
+    if args.pixel_scale < 1 or panel_width % args.pixel_scale or panel_height % (2 * args.pixel_scale):
+        parser.error(f'--pixel-scale {args.pixel_scale} does not divide a {panel_width}x{panel_height} panel')
+    if args.pixel_scale > 1 and args.scan_order != 'sequential':
+        parser.error('--scan-order only applies at --pixel-scale 1; scaled frames are reordered on the Pico')
+    compiler = FrameCompiler(panel_height // args.pixel_scale, panel_width // args.pixel_scale,
+                             args.modulation, args.pix_fmt[:3], scan_order=args.scan_order, dim_planes=args.dim_planes)
+
+    # Unbuffered on both ends, so a slow reader stalls us straight away
+    source = open(sys.stdin.fileno() if args.input == '-' else args.input, 'rb', buffering=0, closefd=args.input != '-')
+    sink = open(sys.stdout.fileno() if args.output == '-' else args.output, 'wb', buffering=0, closefd=args.output != '-')
+    try:
+        stream(compiler, source, sink, args.input_size, args.report, args.frames)
+    except BrokenPipeError:
+        pass
+    finally:
+        source.close()
+        sink.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,424 @@
+import argparse
+import math
+import os
+import sys
+from collections import deque
+import cv2 as cv
+
+import pio_sim
+from frame_compiler import FrameCompiler, PLANE_COUNT, reduce_planes, progressive_planes
+
+'''
+
+Stand-in for the companion board that sends frames live to the Pico over the
+parallel bus 'COPY_TO_PICO/lib/frame_rx.py' receives: six data lines, PCLK
+and FRAME.  bus_changes() turns compiled frames into the pin changes a
+sender makes, which pio_sim.Simulator.play() drives onto the simulated
+Pico's pins while frame_rx runs against them.
+
+AdaptiveSender sends a live stream over a link that is not always fast
+enough, and to a panel that may take frames slower than they are sent.  It
+times every frame it clocks out (the link's throughput), and the ACK line
+tells it when the panel took each frame: one frame is in flight at a time
+(its credit), and the longest wait for an ACK over the last few frames gives
+the panel's frame interval.  At each 1 / fps slot it picks the best step of
+LADDER the measured throughput carries with HEADROOM to spare, and the panel
+can show:
+
+    15 planes every slot, 5 planes, 3 planes, 3 planes every other slot,
+    1 plane every other slot
+
+so on a slower link motion keeps its rate and loses depth first.  It steps
+down as soon as a frame shows the link is slower, and back up after
+STEP_UP_FRAMES frames in a row that would have fitted the better step.  A
+slot is skipped when the frame is the same as the one last sent, or when the
+panel has not taken that one yet.  Every decision is logged with the rates
+it was made on.
+
+Running it sends the images in 'input_data', compiled for a 64x32 panel,
+at 60 fps and checks every one arrives whole and in time, and that a frame
+short of clocks is dropped on its own; then streams them to a 32x16 panel
+over a link that slows down and speeds up again, to a panel that slows
+down, and checks the stream adapts and the panel only shows whole frames.
+Last, it sends scene changes over a slow link, plain and encoded with
+progressive_planes to a receiver set to progressive, and measures how long
+each takes to first show on the panel and to be whole:
+
+    python frame_sender.py [--fps 60] [--pclk 1200000]
+
+The receiving state machine runs at 12 MHz here to keep the simulation
+quick; on the Pico it runs at the system clock, and takes 5 of its cycles
+per byte, so the bus clock is then limited by the sender.
+
+
+'''
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+DATA_BASE = 16
+PCLK_PIN = 22
+FRAME_PIN = 8
+ACK_PIN = 26
+DATA_BITS = 6
+MIN_BLANKING = 500e-6
+
+# (planes, slots per frame), best first
+LADDER = ((15, 1), (5, 1), (3, 1), (3, 2), (1, 2))
+HEADROOM = 0.9
+STEP_UP_FRAMES = 5
+ACK_WINDOW = 16
+ACK_TIMEOUT = 0.25
+
+
+def frame_timing(frame_size, fps, pclk):
+    # Seconds of data and of blanking in every frame period
+    period = 1 / fps
+    data = frame_size / pclk
+    return data, period - data
+
+
+def frame_changes(frame, pclk, delay, data_base=DATA_BASE, pclk_pin=PCLK_PIN, frame_pin=FRAME_PIN):
+    # (delay, {pin: level}) pairs for pio_sim.Simulator.play() sending one
+    # frame: FRAME rises 'delay' after the change before, and falls with the
+    # last byte.  Data and FRAME change as PCLK falls, so they are steady for
+    # the half clock either side of the rising edge.  Ends half a clock after
+    # the last rising edge
+    half = 0.5 / pclk
+    yield delay, {frame_pin: 1, pclk_pin: 0}
+    for i, byte in enumerate(frame):
+        levels = {data_base + bit: (byte >> bit) & 1 for bit in range(DATA_BITS)}
+        if i:
+            levels[pclk_pin] = 0
+        if i == len(frame) - 1:
+            levels[frame_pin] = 0
+        yield half, levels
+        yield half, {pclk_pin: 1}
+    yield half, {pclk_pin: 0}
+
+
+def bus_changes(frames, fps, pclk, skip_bytes=None, data_base=DATA_BASE, pclk_pin=PCLK_PIN, frame_pin=FRAME_PIN):
+    # Frames sent one every 1 / fps.  skip_bytes maps a frame's index to
+    # bytes to leave out
+    skip_bytes = skip_bytes or {}
+    delay = 0.5 / pclk
+    for index, frame in enumerate(frames):
+        data_time, blanking = frame_timing(len(frame), fps, pclk)
+        sent = bytes(frame)[:len(frame) - skip_bytes.get(index, 0)]
+        yield from frame_changes(sent, pclk, delay, data_base, pclk_pin, frame_pin)
+        # Keep each frame period the same length, short frames included
+        delay = blanking + data_time - len(sent) / pclk
+
+
+class AdaptiveSender:
+    def __init__(self, frame_size, fps, clock, log=print):
+        # clock() gives the time in seconds
+        self.plane_size = frame_size // PLANE_COUNT
+        self.fps = fps
+        self.clock = clock
+        self.log = log
+        self.level = 0
+        self.fits = 0
+        self.rate = None
+        self.panel_slots = 1
+        self.waits = deque(maxlen=ACK_WINDOW)
+        self.in_flight = False
+        self.sent_end = None
+        self.last_sent = None
+        self.sent = []
+        self.late = 0
+        self.skipped = {'same': 0, 'credit': 0}
+
+    def need(self, planes, slots):
+        # Bytes per second a frame of 'planes' needs to be sent within 'slots'
+        return planes * self.plane_size / (slots / self.fps - MIN_BLANKING)
+
+    def best_level(self):
+        for level, (planes, slots) in enumerate(LADDER):
+            if self.need(planes, max(slots, self.panel_slots)) <= HEADROOM * self.rate:
+                return level
+        return len(LADDER) - 1
+
+    def ack(self):
+        # The ACK line changed: the panel took the frame in flight
+        if self.in_flight:
+            self.in_flight = False
+            self.waits.append(self.clock() - self.sent_end)
+            panel_slots = max(1, math.ceil(max(self.waits) * self.fps))
+            if panel_slots != self.panel_slots:
+                self.log(f'{self.clock():.3f} s  panel takes a frame every {1000 * max(self.waits):.1f} ms: '
+                         f'{panel_slots} slots per frame (was {self.panel_slots})')
+                self.panel_slots = panel_slots
+
+    def decide(self):
+        if self.rate is None:
+            return
+        best = self.best_level()
+        if best < self.level:
+            self.fits += 1
+            if self.fits < STEP_UP_FRAMES:
+                return
+        elif best == self.level:
+            self.fits = 0
+            return
+        planes, slots = LADDER[best]
+        self.log(f'{self.clock():.3f} s  link {self.rate / 1000:.1f} kB/s, {planes} planes needs '
+                 f'{self.need(planes, max(slots, self.panel_slots)) / 1000:.1f} kB/s: '
+                 f'{"up" if best < self.level else "down"} to {planes} planes every {slots} slots')
+        self.level = best
+        self.fits = 0
+
+    def changes(self, frame_at, link_pclk, slots, data_base=DATA_BASE, pclk_pin=PCLK_PIN, frame_pin=FRAME_PIN):
+        # Pin changes for Simulator.play() from now over 'slots' slots.
+        # frame_at(slot) is the full frame for a slot, link_pclk(t) the clock
+        # the link manages at a time
+        start = self.clock()
+        slot = 0
+        while slot < slots:
+            wait = start + slot / self.fps - self.clock()
+            if wait > 0:
+                yield wait, {}
+            if self.in_flight and self.clock() - self.sent_end > ACK_TIMEOUT:
+                self.log(f'{self.clock():.3f} s  no ACK for {1000 * ACK_TIMEOUT:.0f} ms, taking the frame as lost')
+                self.in_flight = False
+            if self.in_flight:
+                self.skipped['credit'] += 1
+                slot += 1
+                continue
+            self.decide()
+            planes, level_slots = LADDER[self.level]
+            frame = reduce_planes(frame_at(slot), planes)
+            if frame == self.last_sent:
+                self.skipped['same'] += 1
+                slot += 1
+                continue
+
+            sent_start = self.clock()
+            yield from frame_changes(frame, link_pclk(sent_start), 0, data_base, pclk_pin, frame_pin)
+            self.sent_end = self.clock()
+            self.rate = len(frame) / (self.sent_end - sent_start)
+            self.in_flight = True
+            self.last_sent = frame
+            self.sent.append(frame)
+            slot += max(level_slots, self.panel_slots)
+            if self.sent_end + MIN_BLANKING > start + slot / self.fps:
+                # The link slowed under this frame: the next frame waits for
+                # the first slot it can keep
+                self.late += 1
+                self.log(f'{self.clock():.3f} s  {planes} planes took {1000 * (self.sent_end - sent_start):.1f} ms, '
+                         f'late for the next slot')
+                slot = math.ceil((self.sent_end + MIN_BLANKING - start) * self.fps)
+
+
+def sample_frames(width=64, height=32):
+    compiler = FrameCompiler(height, width, 'high_freq', 'bgr')
+    read_dir = os.path.join(SCRIPT_DIR, 'input_data')
+    frames = []
+    for name in sorted(os.listdir(read_dir)):
+        image = cv.imread(os.path.join(read_dir, name))
+        if image is not None:
+            frames.append(bytes(compiler.compile_frame(compiler.resize(image))))
+    return frames
+
+
+def check(label, condition, failures):
+    print(f"{'ok  ' if condition else 'FAIL'} {label}")
+    if not condition:
+        failures.append(label)
+
+
+def run(fps=60, pclk=1_200_000, rx_freq=12_000_000):
+    failures = []
+    frames = sample_frames()
+    frame_size = len(frames[0])
+    data_time, blanking = frame_timing(frame_size, fps, pclk)
+    print(f'     {len(frames)} frames of {frame_size} bytes at {fps:g} fps, PCLK {pclk / 1e6:.2f} MHz: '
+          f'{1000 * data_time:.2f} ms of data, {1000 * blanking:.2f} ms blanking per frame')
+
+    sim = pio_sim.install(pio_sim.Simulator())
+    import frame_rx
+    if blanking * 1e6 < frame_rx.MIN_BLANKING_US:
+        raise ValueError(f'{fps:g} fps needs a PCLK above {frame_size * fps / (1 - fps * frame_rx.MIN_BLANKING_US / 1e6):.0f} Hz')
+
+    receiver = frame_rx.FrameReceiver(frame_size, DATA_BASE, PCLK_PIN, FRAME_PIN, freq=rx_freq)
+    period = sim.time_from_seconds(1 / fps)
+
+    # Sent one after another, each frame should be the latest one from just
+    # after its FRAME falls (plus the DMA interrupt) until the next one's
+    frame_ends = []
+
+    def frame_pin_changed(now, pin):
+        if pin == FRAME_PIN and not sim.gpio.value(pin):
+            frame_ends.append(now)
+
+    sim.gpio.listeners.append(frame_pin_changed)
+    sim.play(bus_changes(frames, fps, pclk))
+    arrived = []
+    latest = []
+    for index in range(len(frames)):
+        sim.run_until(condition=lambda: receiver.frames > index)
+        sim.run_until(condition=lambda: len(frame_ends) > index)
+        arrived.append(sim.seconds(sim.now - frame_ends[index]))
+        sim.run_until(frame_ends[index] + sim.time_from_seconds(blanking / 2))
+        latest.append(bytes(receiver.latest()) == frames[index])
+    check(f'{fps:g} fps: every frame arrives whole', all(latest), failures)
+    print(f'     frames ready {1e6 * min(arrived):.0f}-{1e6 * max(arrived):.0f} us after FRAME falls '
+          f'(the state machine interrupt is taken {1e6 * sys.modules["rp2"].StateMachine.irq_latency:.0f} us '
+          f'after the last byte)')
+    check(f'{fps:g} fps: each frame is ready within the blanking after it', max(arrived) < blanking, failures)
+    check('frames are counted once each', receiver.frames == len(frames), failures)
+
+    # One byte short: the FRAME line ends it where it is, it is dropped, and
+    # the frames after it arrive as usual
+    received = receiver.frames
+    start = sim.now + period
+    sim.play(bus_changes(frames[:4], fps, pclk, skip_bytes={0: 1}), start)
+    sim.run_until(start + 4 * period)
+    check('a short frame is dropped and the next one arrives',
+          bytes(receiver.latest()) == frames[3] and receiver.frames == received + 3, failures)
+
+    receiver.close()
+    run_adaptive(failures)
+    run_progressive(failures)
+    print(f'{len(failures)} failed' if failures else 'all passed')
+    return 1 if failures else 0
+
+
+def run_adaptive(failures, fps=30, rx_freq=2_000_000):
+    # (seconds, link PCLK, panel frame interval, images moving)
+    phases = ((0.6, 200_000, 0.005, True),
+              (0.6, 60_000, 0.005, True),
+              (0.6, 20_000, 0.005, True),
+              (0.6, 200_000, 0.005, True),
+              (0.4, 200_000, 0.005, False),
+              (0.6, 200_000, 0.040, True))
+    ends = [sum(phase[0] for phase in phases[:i + 1]) for i in range(len(phases))]
+
+    def phase_at(t):
+        return phases[min(sum(t >= end for end in ends), len(phases) - 1)]
+
+    frames = sample_frames(32, 16)
+    frame_size = len(frames[0])
+    plane_size = frame_size // PLANE_COUNT
+    print(f'     {len(frames)} frames of {frame_size} bytes streamed at {fps:g} fps: link '
+          f'{", ".join(f"{phase[1] / 1000:.0f}" for phase in phases)} kHz, panel '
+          f'{", ".join(f"{1 / phase[2]:.0f}" for phase in phases)} fps')
+
+    sim = pio_sim.install(pio_sim.Simulator())
+    import frame_rx
+    receiver = frame_rx.FrameReceiver(frame_size, DATA_BASE, PCLK_PIN, FRAME_PIN, freq=rx_freq, ack_pin=ACK_PIN)
+    start = sim.now
+    sender = AdaptiveSender(frame_size, fps, lambda: sim.seconds(sim.now - start), lambda line: print('     ' + line))
+
+    def ack_changed(now, pin):
+        if pin == ACK_PIN:
+            sender.ack()
+
+    sim.gpio.listeners.append(ack_changed)
+
+    # The panel takes the newest frame at the start of each of its own
+    shown = []
+
+    def refresh():
+        frame = receiver.latest()
+        if receiver.frames:
+            shown.append(bytes(frame[:receiver.planes * plane_size]))
+        interval = phase_at(sender.clock())[2]
+        sim.call_at(sim.now + sim.time_from_seconds(interval), refresh)
+
+    refresh()
+
+    def frame_at(slot):
+        return frames[slot % len(frames)] if phase_at(slot / fps)[3] else frames[0]
+
+    sim.play(sender.changes(frame_at, lambda t: phase_at(t)[1], round(ends[-1] * fps)))
+    levels = []
+    sent = []
+    for end in ends:
+        sim.run_until(start + sim.time_from_seconds(end))
+        levels.append(LADDER[sender.level])
+        sent.append(len(sender.sent))
+    receiver.close()
+
+    print(f'     {len(sender.sent)} frames sent, {receiver.frames} received, {receiver.dropped} dropped, '
+          f'{sender.skipped["same"]} slots skipped unchanged, {sender.skipped["credit"]} waiting for the panel')
+    sent_frames = set(sender.sent)
+    check('adaptive: the panel only shows whole frames', all(frame in sent_frames for frame in shown), failures)
+    check('adaptive: every frame sent is received', receiver.frames == len(sender.sent) and not receiver.dropped,
+          failures)
+    check(f'adaptive: depth follows the link ({", ".join(f"{planes}/{slots}" for planes, slots in levels[:4])} '
+          f'planes/slots)', levels[:4] == [LADDER[0], LADDER[1], LADDER[3], LADDER[0]], failures)
+    check(f'adaptive: frames only run late as the link slows ({sender.late})', sender.late <= 2, failures)
+    check('adaptive: a still image is sent once', sent[4] - sent[3] <= 1, failures)
+    check(f'adaptive: a slower panel is sent fewer frames ({sender.panel_slots} slots per frame)',
+          sender.panel_slots == math.ceil(phases[-1][2] * fps), failures)
+
+
+def progressive_latency(frames, progressive, pclk, fps, refresh_interval, rx_freq):
+    # Seconds from each frame's FRAME rising to the first refresh that shows
+    # any of it, and to the first that shows all of it; and whether every
+    # refresh showed only whole planes of one frame sent
+    sim = pio_sim.install(pio_sim.Simulator())
+    import frame_rx
+    frame_size = len(frames[0])
+    plane_size = frame_size // PLANE_COUNT
+    receiver = frame_rx.FrameReceiver(frame_size, DATA_BASE, PCLK_PIN, FRAME_PIN, freq=rx_freq,
+                                      progressive=progressive)
+    sent = [progressive_planes(frame) if progressive else frame for frame in frames]
+    starts = []
+
+    def frame_pin_changed(now, pin):
+        if pin == FRAME_PIN and sim.gpio.value(pin):
+            starts.append(now)
+
+    sim.gpio.listeners.append(frame_pin_changed)
+    first = [None] * len(frames)
+    whole = [None] * len(frames)
+    only_planes = [True]
+
+    def refresh():
+        frame = bytes(receiver.latest()[:receiver.planes * plane_size])
+        matches = [index for index, data in enumerate(sent) if data[:len(frame)] == frame]
+        # (all zeros, a dark panel, until the first frame)
+        if not matches and any(frame):
+            only_planes[0] = False
+        index = len(starts) - 1
+        if index >= 0 and index in matches:
+            if first[index] is None:
+                first[index] = sim.seconds(sim.now - starts[index])
+            if receiver.planes == PLANE_COUNT and whole[index] is None:
+                whole[index] = sim.seconds(sim.now - starts[index])
+        sim.call_at(sim.now + sim.time_from_seconds(refresh_interval), refresh)
+
+    refresh()
+    sim.play(bus_changes(sent, fps, pclk))
+    sim.run_until(sim.now + sim.time_from_seconds(len(frames) / fps))
+    receiver.close()
+    return first, whole, only_planes[0] and None not in whole
+
+
+def run_progressive(failures, pclk=60_000, fps=4, refresh_interval=0.005, rx_freq=2_000_000):
+    frames = sample_frames(32, 16)
+    print(f'     {len(frames)} scene changes of {len(frames[0])} bytes over a {pclk / 1000:.0f} kHz link, '
+          f'the panel taking the newest frame every {1000 * refresh_interval:.0f} ms:')
+    results = {}
+    for progressive in (False, True):
+        first, whole, shown = progressive_latency(frames, progressive, pclk, fps, refresh_interval, rx_freq)
+        results[progressive] = first
+        name = 'progressive' if progressive else 'plain'
+        print(f'     {name:<12} first shown after {1000 * sum(first) / len(first):5.1f} ms on average, '
+              f'whole after {1000 * sum(whole) / len(whole):5.1f} ms')
+        check(f'{name}: the panel only shows planes that have arrived, and every frame whole in the end', shown,
+              failures)
+    gain = sum(results[False]) / sum(results[True])
+    check(f'progressive: scene changes show {gain:.1f}x sooner', gain >= 3, failures)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Send frames to the simulated parallel frame receiver.')
+    parser.add_argument('--fps', type=float, default=60)
+    parser.add_argument('--pclk', type=float, default=1_200_000, help='bus clock in Hz')
+    args = parser.parse_args(argv)
+    return run(args.fps, args.pclk)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,710 @@
+import argparse
+import sys
+import numpy as np
+
+import pio_sim
+
+'''
+
+A HUB-75 panel on the simulated Pico's pins, for checking refresh changes on a
+PC ('pio_sim.py' runs the PIO programs from 'COPY_TO_PICO/lib/hub75.py').
+
+The panel shifts the six color lines in on every rising clock edge, copies
+the shift registers to its output latches while LAT is high (keeping them
+when it falls), and lights the
+latched row pair at the current address whenever OE is low.  Data bits 0-2
+(B, G, R) drive the row 'address + height / 2' and bits 3-5 the row
+'address', which puts every pixel of a compiled frame where it was in the
+source image.  How long each LED has been lit is accumulated, so the result
+can be compared with what the frame should look like.
+
+    python panel_sim.py scale       pixel doubled refresh matches the upscaled frame
+    python panel_sim.py selftest    self-test patterns, and its pass/fail timing
+    python panel_sim.py scan        every scan order shows the image, at any pixel scale
+    python panel_sim.py flicker     how each scan order flickers
+    python panel_sim.py dark        skipping dark rows, and the refresh gain on input_data
+    python panel_sim.py expand      palette expansion on the Pico matches the compiler
+    python panel_sim.py transition  every transition's steps mix the two frames as designed
+    python panel_sim.py timing      high speed shift timing on the pins, in ns, and the image it shows
+    python panel_sim.py dim         OE-dimmed planes for lower bits, and the refresh they save
+    python panel_sim.py zones       zone patches build the frames the compiler does, and what they save
+
+
+'''
+
+PLANE_COUNT = 15
+
+
+class Panel:
+    def __init__(self, sim, width=64, height=32, data_base=10, clock_pin=9, latch_pin=4,
+                 address_base=0, address_bits=4, enable_pin=5):
+        self.sim = sim
+        self.width = width
+        self.height = height
+        self.data_base = data_base
+        self.clock_pin = clock_pin
+        self.latch_pin = latch_pin
+        self.address_base = address_base
+        self.address_bits = address_bits
+        self.enable_pin = enable_pin
+
+        self.shift = np.zeros(width, dtype=np.uint8)
+        self.latched = np.zeros(width, dtype=np.uint8)
+        self.on_time = np.zeros((height, width, 3), dtype=np.float64)
+        self.latches = []
+        self.latch_times = []
+        # Set to a list to record every lit interval as (start, end, address, latched row)
+        self.trace = None
+        self.clock = 0
+        self.latch = 0
+        self.row = self.address()
+        self.on = self.lit()
+        self.since = sim.now
+        self.start = sim.now
+        sim.gpio.listeners.append(self.pin_changed)
+
+    def reset(self):
+        self.on_time[:] = 0
+        self.latches = []
+        self.latch_times = []
+        self.since = self.start = self.sim.now
+
+    def address(self):
+        gpio = self.sim.gpio
+        return sum(gpio.value(self.address_base + i) << i for i in range(self.address_bits))
+
+    def lit(self):
+        return self.sim.gpio.value(self.enable_pin) == 0
+
+    def _accumulate(self, now):
+        # Uses the address and OE as they were since the last change; the
+        # pins may already hold the next ones
+        if now > self.since and self.on:
+            duration = now - self.since
+            address = self.row
+            if self.trace is not None:
+                self.trace.append((self.since, now, address, self.latched.copy()))
+            half = self.height // 2
+            for row, shift in ((address + half, 0), (address, 3)):
+                if row < self.height:
+                    for channel, bit in ((0, 2), (1, 1), (2, 0)):
+                        self.on_time[row, :, channel] += ((self.latched >> (shift + bit)) & 1) * float(duration)
+        self.since = now
+
+    def pin_changed(self, now, pin):
+        gpio = self.sim.gpio
+        if pin == self.clock_pin:
+            clock = gpio.value(pin)
+            if clock and not self.clock:
+                data = sum(gpio.value(self.data_base + i) << i for i in range(6))
+                self.shift[:-1] = self.shift[1:]
+                self.shift[-1] = data
+                if self.latch:
+                    self._accumulate(now)
+                    self.latched[:] = self.shift
+            self.clock = clock
+        elif pin == self.latch_pin:
+            self._accumulate(now)
+            latch = gpio.value(pin)
+            if latch:
+                self.latched[:] = self.shift
+            elif self.latch:
+                if not self.latches:
+                    # Time counts from the first row on show
+                    self.on_time[:] = 0
+                    self.start = now
+                self.latches.append((self.address(), self.latched.tobytes()))
+                self.latch_times.append(now)
+            self.latch = latch
+        elif pin == self.enable_pin or self.address_base <= pin < self.address_base + self.address_bits:
+            self._accumulate(now)
+            self.row = self.address()
+            self.on = self.lit()
+
+    def image(self):
+        # Share of the time each LED has been lit, scaled so the brightest
+        # possible LED (lit in every row slot) would be 1
+        self._accumulate(self.sim.now)
+        elapsed = self.sim.now - self.start
+        rows = self.height // 2
+        return self.on_time * rows / elapsed if elapsed else self.on_time
+
+
+def expected_image(image, modulation='high_freq'):
+    # What a compiled frame should look like: lit planes / PLANE_COUNT
+    from frame_compiler import modulation_table
+    return modulation_table(modulation).sum(axis=0)[image] / PLANE_COUNT
+
+
+def make_display(width=64, height=32, pixel_scale=1, freq=1_000_000, scan_order='sequential', skip_dark_rows=False,
+                 timing=None, sys_freq=125_000_000, dim_planes=0):
+    # A simulator with hub75's state machines and a panel on display.py's pins
+    sim = pio_sim.install(pio_sim.Simulator(sys_freq))
+    import hub75
+    from machine import Pin
+
+    Pin(5, Pin.OUT, value=0)
+    panel = Panel(sim, width, height)
+    led_data_sm, address_counter_sm = hub75.init_state_machines(freq, width, height // 2, pixel_scale, scan_order,
+                                                               skip_dark_rows, timing=timing,
+                                                               dim_planes=dim_planes)
+    address_counter_sm.active(1)
+    led_data_sm.active(1)
+    return sim, panel, led_data_sm, address_counter_sm
+
+
+def show_frame(frame, width, pixel_scale, panel, led_data_sm, repeats=2, scan_order='sequential', in_scan_order=True,
+               address_counter_sm=None, rows=None):
+    # Runs the device's feeder for a number of whole frames, then gives the
+    # last row as long on show as the others had.  Passing
+    # address_counter_sm skips dark rows, as display.py does; rows, a row
+    # list made elsewhere (a transition's), is sent instead of the frame
+    import hub75
+
+    skip_dark_rows = address_counter_sm is not None
+    if rows is None:
+        rows = hub75.frame_rows(frame, width, panel.height // 2, pixel_scale, scan_order, in_scan_order, skip_dark_rows)
+    for _ in range(repeats):
+        hub75.put_frame(led_data_sm, frame, rows, address_counter_sm)
+    sim = panel.sim
+    count = repeats * (lit_slots(rows, width // pixel_scale) if skip_dark_rows else PLANE_COUNT * panel.height // 2)
+    sim.run_until(condition=lambda: len(panel.latches) >= count)
+    sim.run_until(sim.now + (sim.now - panel.start) // (count - 1))
+
+
+def lit_slots(groups, row_bytes):
+    # Row slots a skip_dark_rows display list sends
+    return sum(len(row) for dark, rows in groups for row in rows) // row_bytes
+
+
+def check(name, condition, failures):
+    print(f"{'ok  ' if condition else 'FAIL'} {name}")
+    if not condition:
+        failures.append(name)
+
+
+def check_scale(failures, width=64, height=32):
+    from frame_compiler import FrameCompiler
+
+    # Content authored at a quarter of the panel's resolution, stored at
+    # native resolution and at 1/2 and 1/4 of it
+    native = np.random.default_rng(1).integers(0, 256, (height // 4, width // 4, 3), dtype=np.uint8)
+    results = {}
+    for pixel_scale in (1, 2, 4):
+        stored = native.repeat(4 // pixel_scale, axis=0).repeat(4 // pixel_scale, axis=1)
+        compiler = FrameCompiler(height // pixel_scale, width // pixel_scale)
+        frame = bytes(compiler.compile_frame(stored))
+        sim, panel, led_data_sm, address_counter_sm = make_display(width, height, pixel_scale)
+        show_frame(frame, width, pixel_scale, panel, led_data_sm)
+        results[pixel_scale] = (len(frame), panel.latches, panel.image(), sim.seconds())
+
+    reference = results[1]
+    upscaled = native.repeat(4, axis=0).repeat(4, axis=1)
+    check('scale 1 shows the frame', np.allclose(reference[2], expected_image(upscaled), atol=0.01), failures)
+    for pixel_scale in (2, 4):
+        size, latches, image, seconds = results[pixel_scale]
+        check(f'scale {pixel_scale} frame is 1/{pixel_scale ** 2} the size', size * pixel_scale ** 2 == reference[0], failures)
+        check(f'scale {pixel_scale} latches the same rows', latches == reference[1], failures)
+        check(f'scale {pixel_scale} lights the same image', np.allclose(image, reference[2], atol=0.01), failures)
+        print(f'     scale {pixel_scale}: {size} bytes, refresh time x{seconds / reference[3]:.2f}')
+
+
+def check_selftest(failures, width=64, height=32, freq=1_000_000):
+    import contextlib
+    import io
+    from frame_compiler import FrameCompiler
+
+    sim, panel, led_data_sm, address_counter_sm = make_display(width, height, freq=freq)
+    import selftest
+
+    # Patterns use levels 0-15, which the compiler reads from 8-bit values 15 apart
+    compiler = FrameCompiler(height, width)
+    frame = bytearray(compiler.frame_size)
+    layout_ok = True
+    for name, pattern in selftest.PATTERNS:
+        selftest.fill(frame, width, height, pattern)
+        image = np.array([[pattern(x, y, width, height) for x in range(width)] for y in range(height)], dtype=np.uint8) * 15
+        layout_ok = layout_ok and frame == bytes(compiler.compile_frame(image))
+    check('patterns match the compiled frames', layout_ok, failures)
+
+    log = io.StringIO()
+    with contextlib.redirect_stdout(log):
+        passed = selftest.run(led_data_sm, width, height, freq, frames=1)
+    print('\n'.join('     ' + line for line in log.getvalue().splitlines()))
+    check('self-test passes on a healthy refresh', passed, failures)
+
+    # A refresh running at half the speed it should looks like a starved FIFO
+    sim, panel, led_data_sm, address_counter_sm = make_display(width, height, freq=freq // 2)
+    with contextlib.redirect_stdout(io.StringIO()):
+        passed = selftest.run(led_data_sm, width, height, freq, frames=1)
+    check('self-test fails when frames take too long', not passed, failures)
+
+
+def flicker_spectrum(panel, start, period, block, harmonics):
+    # Fourier amplitudes (harmonics of the frame rate, DC first) of the light
+    # from blocks of 'block' neighbouring rows, one LED wide, over one frame;
+    # averaged over the blocks of the top half
+    half = panel.height // 2
+    k = np.arange(harmonics + 1)
+    spectra = np.zeros((half // block, harmonics + 1), dtype=np.complex128)
+    for t0, t1, address, latched in panel.trace:
+        t0 = max(t0, start)
+        t1 = min(t1, start + period)
+        if t1 <= t0 or not (latched[0] >> 5) & 1:
+            continue
+        # Red of the top half's LED in column 0
+        a0 = 2 * np.pi * (t0 - start) / period
+        a1 = 2 * np.pi * (t1 - start) / period
+        with np.errstate(divide='ignore', invalid='ignore'):
+            c = np.where(k == 0, a1 - a0, (np.exp(-1j * k * a1) - np.exp(-1j * k * a0)) / (-1j * np.maximum(k, 1)))
+        spectra[address // block] += c / (2 * np.pi)
+    return np.abs(spectra).mean(axis=0)
+
+
+def flicker_report(scan_order, level=7, width=64, height=32, harmonics=None):
+    # Simulates a flat image at one level and measures how the light of a
+    # single LED, and of 2 and 4 neighbouring rows seen together, flickers
+    from frame_compiler import FrameCompiler
+
+    slots = PLANE_COUNT * height // 2
+    harmonics = harmonics or 2 * slots
+    compiler = FrameCompiler(height, width, scan_order=scan_order)
+    frame = bytes(compiler.compile_frame(np.full((height, width, 3), level * 15, dtype=np.uint8)))
+    sim, panel, led_data_sm, address_counter_sm = make_display(width, height, scan_order=scan_order)
+    panel.trace = []
+    show_frame(frame, width, 1, panel, led_data_sm, repeats=3, scan_order=scan_order)
+
+    # Whole frames start with each frame's first latch
+    start = panel.latch_times[slots]
+    period = panel.latch_times[slots] - panel.latch_times[0]
+    report = {}
+    for block in (1, 2, 4):
+        spectrum = flicker_spectrum(panel, start, period, block, harmonics)
+        ac = spectrum[1:]
+        # Lowest harmonic carrying at least a quarter of the strongest one's
+        # amplitude: the slowest flicker that is plainly there
+        lowest = int(np.argmax(ac >= 0.25 * ac.max())) + 1
+        slow = (ac[:PLANE_COUNT - 1] ** 2).sum() / (ac ** 2).sum()
+        report[block] = (lowest, int(np.argmax(ac)) + 1, slow)
+    return report
+
+
+def check_scan(failures, width=64, height=32):
+    from frame_compiler import FrameCompiler, SCAN_ORDERS, scan_slots
+
+    image = np.random.default_rng(2).integers(0, 256, (height, width, 3), dtype=np.uint8)
+    small = image[::2, ::2]
+    for scan_order in SCAN_ORDERS:
+        # Full resolution frames compiled in scan order, frames at the
+        # sequential layout (as the self-test draws them), and scaled frames
+        frame = bytes(FrameCompiler(height, width, scan_order=scan_order).compile_frame(image))
+        sim, panel, led_data_sm, address_counter_sm = make_display(width, height, scan_order=scan_order)
+        show_frame(frame, width, 1, panel, led_data_sm, scan_order=scan_order)
+        check(f'{scan_order}: compiled frame shows the image',
+              np.allclose(panel.image(), expected_image(image), atol=0.01), failures)
+
+        frame = bytes(FrameCompiler(height, width).compile_frame(image))
+        sim, panel, led_data_sm, address_counter_sm = make_display(width, height, scan_order=scan_order)
+        show_frame(frame, width, 1, panel, led_data_sm, scan_order=scan_order, in_scan_order=False)
+        check(f'{scan_order}: sequential frame shows the image',
+              np.allclose(panel.image(), expected_image(image), atol=0.01), failures)
+
+        frame = bytes(FrameCompiler(height // 2, width // 2).compile_frame(small))
+        sim, panel, led_data_sm, address_counter_sm = make_display(width, height, 2, scan_order=scan_order)
+        show_frame(frame, width, 2, panel, led_data_sm, scan_order=scan_order)
+        upscaled = small.repeat(2, axis=0).repeat(2, axis=1)
+        check(f'{scan_order}: scaled frame shows the image',
+              np.allclose(panel.image(), expected_image(upscaled), atol=0.01), failures)
+
+    import hub75
+    for scan_order in SCAN_ORDERS:
+        check(f'{scan_order}: compiler and Pico agree on the order',
+              hub75.scan_slots(height // 2, scan_order) == scan_slots(height // 2, scan_order), failures)
+
+
+def check_flicker(failures, width=64, height=32, pio_freq=20_000):
+    # Not pass/fail beyond the orders behaving as designed; prints how each
+    # scan order flickers, in multiples of the frame rate and in Hz at
+    # display.py's PIO clock
+    pio_sim.install(pio_sim.Simulator())
+    import hub75
+    from frame_compiler import SCAN_ORDERS
+
+    frame_rate = pio_freq / (hub75.row_cycles(width) * PLANE_COUNT * height // 2)
+    print(f'     flat level 7 image; frame rate {frame_rate:.3f} Hz at a {pio_freq} Hz PIO clock')
+    print(f"     {'scan order':<12} {'rows':>4} {'lowest':>16} {'strongest':>16} {'below plane rate':>17}")
+    reports = {}
+    for scan_order in SCAN_ORDERS:
+        reports[scan_order] = report = flicker_report(scan_order, width=width, height=height)
+        for block, (lowest, strongest, slow) in report.items():
+            print(f'     {scan_order:<12} {block:>4} {lowest:>5}x {lowest * frame_rate:>6.2f} Hz '
+                  f'{strongest:>5}x {strongest * frame_rate:>6.2f} Hz {100 * slow:>16.1f}%')
+    check('interleaved doubles the flicker rate of neighbouring row pairs',
+          reports['interleaved'][2][1] >= 2 * reports['sequential'][2][1], failures)
+    check('interleaved leaves single LEDs as they were',
+          reports['interleaved'][1][:2] == reports['sequential'][1][:2], failures)
+
+
+def check_dark(failures, width=64, height=32, freq=1_000_000):
+    import os
+    import cv2 as cv
+    from frame_compiler import FrameCompiler, SCAN_ORDERS
+
+    slots = PLANE_COUNT * height // 2
+    # Rows left black, and dim rows only lit in a few planes
+    image = np.random.default_rng(4).integers(0, 256, (height, width, 3), dtype=np.uint8)
+    image[:height // 4] = 0
+    image[height // 2:height // 2 + 4] //= 16
+    small = image[::2, ::2]
+    for scan_order in SCAN_ORDERS:
+        cases = [
+            ('compiled frame', FrameCompiler(height, width, scan_order=scan_order, skip_dark_rows=True), image, 1, True),
+            ('sequential frame', FrameCompiler(height, width), image, 1, False),
+            ('scaled frame', FrameCompiler(height // 2, width // 2), small, 2, True),
+        ]
+        for name, compiler, source, pixel_scale, in_scan_order in cases:
+            frame = bytes(compiler.compile_frame(source))
+            sim, panel, led_data_sm, address_counter_sm = make_display(width, height, pixel_scale, scan_order=scan_order,
+                                                                       skip_dark_rows=True)
+            import hub75
+            show_frame(frame, width, pixel_scale, panel, led_data_sm, scan_order=scan_order,
+                       in_scan_order=in_scan_order, address_counter_sm=address_counter_sm)
+            groups = hub75.frame_rows(frame, width, height // 2, pixel_scale, scan_order, in_scan_order, True)
+            lit = lit_slots(groups, width // pixel_scale)
+            upscaled = source.repeat(pixel_scale, axis=0).repeat(pixel_scale, axis=1)
+            # Every lit slot is on show as long as before, the frame is just shorter
+            check(f'{scan_order}: {name} shows the image skipping {slots - lit} of {slots} rows',
+                  np.allclose(panel.image() * lit / slots, expected_image(upscaled), atol=0.01), failures)
+            if pixel_scale == 1 and in_scan_order:
+                cycles = sim.seconds(panel.latch_times[lit] - panel.latch_times[0]) * freq
+                check(f'{scan_order}: a frame takes row_cycles per lit row',
+                      abs(cycles / (lit * hub75.row_cycles(width)) - 1) < 0.01, failures)
+
+    # A black frame still latches a (blank) row, so the last lit row of the
+    # frame before does not stay on
+    black = np.zeros((height, width, 3), dtype=np.uint8)
+    frame = bytes(FrameCompiler(height, width, skip_dark_rows=True).compile_frame(black))
+    sim, panel, led_data_sm, address_counter_sm = make_display(width, height, skip_dark_rows=True)
+    show_frame(bytes(FrameCompiler(height, width, skip_dark_rows=True).compile_frame(image)), width, 1, panel,
+               led_data_sm, address_counter_sm=address_counter_sm)
+    show_frame(frame, width, 1, panel, led_data_sm, address_counter_sm=address_counter_sm)
+    panel.reset()
+    sim.run_until(sim.now + sim.time_from_seconds(0.01))
+    check('a black frame goes dark', not panel.image().any(), failures)
+
+    # Refresh rate on the sample images at display.py's settings, from the
+    # cycles of the rows actually shifted
+    read_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'input_data')
+    compiler = FrameCompiler(height, width, 'high_freq', 'bgr', skip_dark_rows=True)
+    print(f"     {'image':<28} {'rows shifted':>12} {'refresh gain':>12}")
+    for name in sorted(os.listdir(read_dir)):
+        image = cv.imread(os.path.join(read_dir, name))
+        if image is None:
+            continue
+        frame = bytes(compiler.compile_frame(compiler.resize(image)))
+        lit = lit_slots(hub75.frame_rows(frame, width, height // 2, skip_dark_rows=True), width)
+        print(f'     {name:<28} {lit:>5} / {slots:<4} {slots / lit:>11.2f}x')
+
+
+def check_expand(failures, width=64, height=32):
+    # The Pico's palette expansion gives the frames the compiler does, with
+    # the software kernel and on the interpolator model
+    from frame_compiler import FrameCompiler
+
+    pio_sim.install(pio_sim.Simulator())
+    import expand
+
+    rng = np.random.default_rng(6)
+    palettes = {'random': rng.integers(0, 256, (256, 3), dtype=np.uint8),
+                'rgb332': np.array(expand.rgb332_palette(), dtype=np.uint8)}
+    indices = rng.integers(0, 256, (height, width), dtype=np.uint8)
+    for name, palette in palettes.items():
+        for modulation in ('high_freq', 'basic'):
+            reference = bytes(FrameCompiler(height, width, modulation).compile_frame(palette[indices]))
+            for use_interp in (False, True):
+                expander = expand.Expander(width, height, palette.tolist(), modulation, use_interp)
+                frame = expander.expand(bytearray(expander.frame_size), bytearray(indices.tobytes()))
+                check(f"{name} palette, {modulation}: {'interpolator' if use_interp else 'software'} kernel",
+                      bytes(frame) == reference, failures)
+
+
+def check_transition(failures, width=64, height=32, steps=15):
+    from frame_compiler import FrameCompiler, modulation_table
+
+    rng = np.random.default_rng(7)
+    old_image = rng.integers(0, 256, (height, width, 3), dtype=np.uint8)
+    new_image = rng.integers(0, 256, (height, width, 3), dtype=np.uint8)
+    lit = modulation_table('high_freq')
+    half = height // 2
+
+    def planes_image(image, planes):
+        # Brightness of an image shown with only some of its planes
+        return lit[sorted(planes)].sum(axis=0)[image] / PLANE_COUNT
+
+    for scan_order in ('sequential', 'row_planes'):
+        compiler = FrameCompiler(height, width, scan_order=scan_order)
+        old = bytes(compiler.compile_frame(old_image))
+        new = bytes(compiler.compile_frame(new_image))
+        sim, panel, led_data_sm, address_counter_sm = make_display(width, height, scan_order=scan_order)
+        import transition
+
+        def shown(kind, step):
+            steps_of = transition.Transition(kind, width, half, scan_order=scan_order)
+            steps_of.begin(old, new)
+            panel.reset()
+            show_frame(None, width, 1, panel, led_data_sm, rows=steps_of.rows(step, steps))
+            return steps_of, panel.image()
+
+        for kind in transition.TRANSITIONS:
+            ends = shown(kind, 0)[1], shown(kind, steps)[1]
+            check(f'{scan_order}: {kind} starts on the old frame and ends on the new',
+                  np.allclose(ends[0], expected_image(old_image), atol=0.01)
+                  and np.allclose(ends[1], expected_image(new_image), atol=0.01), failures)
+
+            step = steps // 3
+            steps_of, image = shown(kind, step)
+            ranks = transition.PLANE_MIX_ORDER
+            if kind == 'crossfade':
+                mixed = PLANE_COUNT * step // steps
+                expected = planes_image(new_image, ranks[:mixed]) + planes_image(old_image, ranks[mixed:])
+                blend = step / steps
+                linear = blend * expected_image(new_image) + (1 - blend) * expected_image(old_image)
+                print(f'     crossfade {step}/{steps}: mean error from a linear blend {np.abs(image - linear).mean():.3f}')
+            elif kind == 'fade':
+                expected = planes_image(old_image, ranks[:PLANE_COUNT - PLANE_COUNT * 2 * step // steps])
+            elif kind == 'cut':
+                expected = expected_image(new_image)
+            elif kind in ('wipe', 'slide'):
+                split = width * step // steps
+                if kind == 'wipe':
+                    composed = np.concatenate([new_image[:, :split], old_image[:, split:]], axis=1)
+                else:
+                    composed = np.concatenate([old_image[:, split:], new_image[:, :split]], axis=1)
+                expected = expected_image(composed)
+            else:
+                switched = half * step // steps
+                new_rows = np.array([steps_of.address_rank[y % half] < switched for y in range(height)])
+                expected = expected_image(np.where(new_rows[:, None, None], new_image, old_image))
+            check(f'{scan_order}: {kind} {step}/{steps} shows the expected mix',
+                  np.allclose(image, expected, atol=0.01), failures)
+
+
+class PinTimes:
+    # Shortest times between edges on the panel's pins, in ns, over
+    # everything the simulator runs while it listens
+    def __init__(self, sim, data_base=10, clock_pin=9, latch_pin=4, address_base=0, address_bits=4):
+        self.sim = sim
+        self.data_pins = range(data_base, data_base + 6)
+        self.clock_pin = clock_pin
+        self.latch_pin = latch_pin
+        self.address_pins = range(address_base, address_base + address_bits)
+        self.data_changed = self.address_changed = self.clock_changed = self.latch_rose = None
+        self.times = {}
+        sim.gpio.listeners.append(self.pin_changed)
+
+    def _shortest(self, name, since, now):
+        if since is not None:
+            ns = self.sim.seconds(now - since) * 1e9
+            self.times[name] = min(self.times.get(name, ns), ns)
+
+    def pin_changed(self, now, pin):
+        value = self.sim.gpio.value(pin)
+        if pin in self.data_pins:
+            self.data_changed = now
+        elif pin in self.address_pins:
+            self.address_changed = now
+        elif pin == self.clock_pin:
+            self._shortest('clock high' if not value else 'clock low', self.clock_changed, now)
+            if value:
+                self._shortest('data setup', self.data_changed, now)
+            self.clock_changed = now
+        elif pin == self.latch_pin:
+            if value:
+                self._shortest('address setup', self.address_changed, now)
+                self.latch_rose = now
+            else:
+                self._shortest('latch', self.latch_rose, now)
+
+
+def check_timing(failures, width=64, height=32, sys_freq=250_000_000):
+    # display.py's HIGH_SPEED_SHIFT figures at its MACHINE_FREQ, and tighter
+    # ones that need the whole delay fields; every time on the pins is at
+    # least the one asked for and the panel still shows the frame
+    pio_sim.install(pio_sim.Simulator())
+    import hub75
+    from frame_compiler import FrameCompiler
+
+    image = np.random.default_rng(8).integers(0, 256, (height, width, 3), dtype=np.uint8)
+    small = image[::2, ::2]
+    cases = [((25, 25, 100, 50), sys_freq), ((10, 60, 200, 30), sys_freq), ((25, 25, 100, 50), 125_000_000)]
+    for figures, freq in cases:
+        wanted = dict(zip(('data setup', 'clock high', 'address setup', 'latch'), figures))
+        timing = hub75.shift_timing(freq, *figures)
+        for pixel_scale, source in ((1, image), (2, small)):
+            frame = bytes(FrameCompiler(height // pixel_scale, width // pixel_scale).compile_frame(source))
+            sim, panel, led_data_sm, address_counter_sm = make_display(width, height, pixel_scale, timing=timing,
+                                                                       sys_freq=freq)
+            times = PinTimes(sim)
+            show_frame(frame, width, pixel_scale, panel, led_data_sm)
+            measured = ', '.join(f'{name} {ns:.0f}' for name, ns in sorted(times.times.items()))
+            print(f'     {freq / 1e6:.0f} MHz, scale {pixel_scale}: state machines at {timing.freq / 1e6:.1f} MHz, '
+                  f'column clock {timing.clock_hz(pixel_scale) / 1e6:.2f} MHz; ns: {measured}')
+            check(f'{figures} ns at {freq / 1e6:.0f} MHz, scale {pixel_scale}: every time at least as asked',
+                  all(times.times[name] >= ns - 1e-6 for name, ns in wanted.items()), failures)
+            # OE blanks every row from the address change until LAT falls
+            lit = 1 - (1 + timing.address_setup + timing.latch) / hub75.row_cycles(width, pixel_scale, timing)
+            upscaled = source.repeat(pixel_scale, axis=0).repeat(pixel_scale, axis=1)
+            check(f'{figures} ns at {freq / 1e6:.0f} MHz, scale {pixel_scale}: the panel shows the frame, '
+                  f'lit {100 * lit:.1f}% of each row',
+                  np.allclose(panel.image() / lit, expected_image(upscaled), atol=0.01), failures)
+            cycles = sim.seconds(panel.latch_times[-1] - panel.latch_times[0]) * timing.freq
+            check(f'{figures} ns at {freq / 1e6:.0f} MHz, scale {pixel_scale}: a row takes row_cycles',
+                  abs(cycles / ((len(panel.latch_times) - 1) * hub75.row_cycles(width, pixel_scale, timing)) - 1)
+                  < 0.01, failures)
+
+    # The default program changes the data with the rising edge
+    sim, panel, led_data_sm, address_counter_sm = make_display(width, height)
+    times = PinTimes(sim)
+    show_frame(bytes(FrameCompiler(height, width).compile_frame(image)), width, 1, panel, led_data_sm, repeats=1)
+    print(f"     without a ShiftTiming at 1 MHz: data setup {times.times['data setup']:.0f} ns")
+
+
+def check_dim(failures, width=64, height=32, sys_freq=250_000_000):
+    # Frames with dim planes at display.py's HIGH_SPEED_SHIFT defaults show
+    # every plane at its weight, with rows as long as ever; then the frame
+    # rate that saves over giving the lowest bit a whole row slot
+    pio_sim.install(pio_sim.Simulator())
+    import hub75
+    from frame_compiler import FrameCompiler, modulation_table, plane_weights, DIM_PLANES_MAX
+
+    timing = hub75.shift_timing(sys_freq, 25, 25, 100, 50)
+    levels = (modulation_table('high_freq', DIM_PLANES_MAX) * plane_weights(DIM_PLANES_MAX)[:, None]).sum(axis=0)
+    check(f'{DIM_PLANES_MAX} dim planes give 256 rising levels', (np.diff(levels) > 0).all(), failures)
+
+    rng = np.random.default_rng(9)
+    for scan_order in ('sequential', 'interleaved'):
+        for pixel_scale, dim_planes in ((1, DIM_PLANES_MAX), (2, 2)):
+            source = rng.integers(0, 256, (height // pixel_scale, width // pixel_scale, 3), dtype=np.uint8)
+            compiler = FrameCompiler(height // pixel_scale, width // pixel_scale, dim_planes=dim_planes,
+                                     scan_order=scan_order if pixel_scale == 1 else 'sequential')
+            frame = bytes(compiler.compile_frame(source))
+            on_cycles = hub75.plane_on_cycles(width, pixel_scale, timing, dim_planes)
+            rows = hub75.frame_rows(frame, width, height // 2, pixel_scale, scan_order, on_cycles=on_cycles)
+            sim, panel, led_data_sm, address_counter_sm = make_display(width, height, pixel_scale,
+                                                                       scan_order=scan_order, timing=timing,
+                                                                       sys_freq=sys_freq, dim_planes=dim_planes)
+            repeats = 2
+            for _ in range(repeats):
+                hub75.put_frame(led_data_sm, frame, rows, address_counter_sm)
+            count = repeats * compiler.planes * height // 2
+            sim.run_until(condition=lambda: len(panel.latches) >= count)
+            sim.run_until(sim.now + (sim.now - panel.start) // (count - 1))
+
+            # Brightness in full planes, out of compiler.planes row slots,
+            # each lit for a full plane's word plus 4 cycles of row_cycles
+            cycles = hub75.row_cycles(width, pixel_scale, timing)
+            lit = (on_cycles[0] + 4) / cycles * PLANE_COUNT / compiler.planes
+            upscaled = source.repeat(pixel_scale, axis=0).repeat(pixel_scale, axis=1)
+            weighted = (modulation_table('high_freq', dim_planes) * plane_weights(dim_planes)[:, None]).sum(axis=0)
+            expected = weighted[upscaled] / PLANE_COUNT
+            name = f'{scan_order}, scale {pixel_scale}, {dim_planes} dim planes'
+            check(f'{name}: every plane is lit for its weight',
+                  np.allclose(panel.image() / lit, expected, atol=0.002), failures)
+            shown = sim.seconds(panel.latch_times[-1] - panel.latch_times[0]) * timing.freq
+            check(f'{name}: rows take no longer than row_cycles',
+                  shown <= (len(panel.latch_times) - 1) * cycles, failures)
+
+    # Frame rate by bits per color, if the feeder keeps up: every LSB in a
+    # row slot of its own (2^bits - 1 slots, as equal planes or as binary
+    # weights with the shortest one a row long) against 15 planes and a dim
+    # plane per bit below the top four
+    cycles = hub75.row_cycles(width, 1, timing)
+    frame_rate = lambda slots: timing.freq / (cycles * slots * height // 2)
+    print(f'     {width}x{height} at {timing.freq / 1e6:.0f} MHz, {cycles} cycles a row:')
+    print(f"     {'bits':>4} {'whole slots':>12} {'with dim planes':>16} {'gain':>6}")
+    for bits in range(4, 5 + DIM_PLANES_MAX):
+        whole = (1 << bits) - 1
+        dimmed = PLANE_COUNT + bits - 4
+        print(f'     {bits:>4} {frame_rate(whole):>9.0f} Hz {frame_rate(dimmed):>13.0f} Hz {whole / dimmed:>5.1f}x')
+
+
+def check_zones(failures, width=64, height=32):
+    # Zones updated one at a time on the Pico, from frames of their own
+    # content, keep the frame a whole compile of every zone's latest image
+    # gives, and only touch their own bytes and bits
+    pio_sim.install(pio_sim.Simulator())
+    import zones
+    from frame_compiler import FrameCompiler
+    from zone_compiler import zone_owner, zone_runs, zone_patch
+
+    layout = [{'NAME': 'logo', 'X': 0, 'Y': 0, 'WIDTH': 16, 'HEIGHT': 32},
+              {'NAME': 'price', 'X': 16, 'Y': 0, 'WIDTH': 48, 'HEIGHT': 20},
+              {'NAME': 'ticker', 'X': 16, 'Y': 20, 'WIDTH': 48, 'HEIGHT': 12}]
+    rng = np.random.default_rng(10)
+    for scan_order, pixel_scale, dim_planes in (('sequential', 1, 0), ('interleaved', 1, 0), ('row_planes', 1, 0),
+                                                ('sequential', 2, 0), ('interleaved', 1, 2)):
+        compiler = FrameCompiler(height // pixel_scale, width // pixel_scale, dim_planes=dim_planes,
+                                 scan_order=scan_order if pixel_scale == 1 else 'sequential')
+        owners = [zone_owner(compiler, zone, pixel_scale) for zone in layout]
+        device = [zones.Zone(zone['NAME'], 0, [value for run in zone_runs(owner) for value in run], ['-'])
+                  for zone, owner in zip(layout, owners)]
+        frame = bytearray(compiler.frame_size)
+        canvas = np.zeros((compiler.height, compiler.width, 3), dtype=np.uint8)
+        name = f'{scan_order}, scale {pixel_scale}, {dim_planes} dim planes'
+        same = True
+        for update in range(8):
+            k = 0 if update == 0 else 1 + update % 2
+            zone, owner = layout[k], owners[k]
+            x, y = zone['X'] // pixel_scale, zone['Y'] // pixel_scale
+            w, h = zone['WIDTH'] // pixel_scale, zone['HEIGHT'] // pixel_scale
+            image = rng.integers(0, 256, (h, w, 3), dtype=np.uint8)
+            canvas[y:y + h, x:x + w] = image
+            before = bytes(frame)
+            device[k].apply(frame, zone_patch(compiler, image, zone, owner, pixel_scale))
+            changed = np.frombuffer(before, dtype=np.uint8) ^ np.frombuffer(bytes(frame), dtype=np.uint8)
+            same &= bytes(frame) == bytes(compiler.compile_frame(canvas)) and not (changed & ~owner).any()
+        check(f'{name}: zone updates give the whole frame and touch only their bits', same, failures)
+        check(f'{name}: the zones own every bit once',
+              np.array_equal(sum(owners), np.full(compiler.frame_size, 0x3F)), failures)
+        if (scan_order, pixel_scale, dim_planes) == ('sequential', 1, 0):
+            # Bytes read for each zone's update, against a whole frame
+            for zone, device_zone in zip(layout, device):
+                print(f"     {zone['NAME']} {zone['WIDTH']}x{zone['HEIGHT']}: {device_zone.patch_size} bytes in "
+                      f"{device_zone.run_count} runs, {device_zone.patch_size / compiler.frame_size:.0%} of a frame")
+            sim, panel, led_data_sm, address_counter_sm = make_display(width, height)
+            show_frame(bytes(frame), width, 1, panel, led_data_sm)
+            check(f'{name}: the panel shows every zone where it belongs',
+                  np.allclose(panel.image(), expected_image(canvas), atol=0.01), failures)
+
+
+CHECKS = {
+    'dark': check_dark,
+    'dim': check_dim,
+    'expand': check_expand,
+    'flicker': check_flicker,
+    'scale': check_scale,
+    'scan': check_scan,
+    'selftest': check_selftest,
+    'timing': check_timing,
+    'transition': check_transition,
+    'zones': check_zones,
+}
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Check the HUB-75 refresh against a simulated panel.')
+    parser.add_argument('checks', nargs='*', help=f"any of {', '.join(sorted(CHECKS))} (default all)")
+    args = parser.parse_args(argv)
+    unknown = [name for name in args.checks if name not in CHECKS]
+    if unknown:
+        parser.error(f"unknown check '{unknown[0]}'")
+
+    failures = []
+    for name in args.checks or sorted(CHECKS):
+        CHECKS[name](failures)
+    print(f'{len(failures)} failed' if failures else 'all passed')
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
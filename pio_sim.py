@@ -0,0 +1,1306 @@
+import heapq
+import os
+import sys
+import types
+from collections import deque
+
+'''
+
+Cycle-level simulator of the RP2040's PIO blocks, for running the device's PIO
+programs on a PC.
+
+install() puts stand-ins for MicroPython's 'rp2', 'machine', 'micropython',
+'utime' and 'uctypes' modules into sys.modules, so modules from 'COPY_TO_PICO'
+can be imported unchanged: rp2.asm_pio assembles programs to the same
+instruction words as on the Pico, and rp2.StateMachine runs them on a
+Simulator instead of hardware.  Pins are shared through a GPIO model that other models (such as
+the HUB-75 panel in 'panel_sim.py') can watch and drive; Simulator.play()
+drives them from a timed list of changes, as an external sender would
+('frame_sender.py').  rp2.DMA only covers moving RX FIFO words into a buffer;
+state machine IRQs (StateMachine.irq) and DMA completion call their
+handlers a little later, as soft IRQs.
+Viper code runs as plain Python, with ptr8/ptr16/ptr32 over buffers, over
+the SIO interpolators' registers (Interpolator) and at addresses
+uctypes.addressof gave out.
+
+Time is counted in 1/256ths of a system clock cycle, which is the resolution
+of the PIO clock dividers, so state machines at different frequencies stay in
+step exactly as they do on the chip.  FIFOs, autopush/autopull, side-set,
+delays, wrap, IRQ flags and exec behave as described in the RP2040 datasheet;
+the two cycle input synchroniser is not modelled.  utime's clocks read this
+simulated time, which moves only while the hardware runs (in a blocking put
+or get, or a sleep); Python code in between takes no time at all.
+
+
+'''
+
+LIB_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'COPY_TO_PICO', 'lib')
+
+SUBCYCLES = 256
+_SRAM_BASE = 0x20000000
+
+
+class PIOASMError(Exception):
+    pass
+
+
+# Same layout and encodings as MicroPython's rp2.asm_pio, so programs assemble
+# to the same words they do on the device
+_PROG_DATA = 0
+_PROG_EXECCTRL = 3
+_PROG_SHIFTCTRL = 4
+_PROG_OUT_PINS = 5
+_PROG_SET_PINS = 6
+_PROG_SIDESET_PINS = 7
+
+
+class PIOASMEmit:
+    def __init__(self, *, out_init=None, set_init=None, sideset_init=None, in_shiftdir=0, out_shiftdir=0,
+                 autopush=False, autopull=False, push_thresh=32, pull_thresh=32, fifo_join=0):
+        self.labels = {}
+        shiftctrl = (fifo_join << 30 | (pull_thresh & 0x1F) << 25 | (push_thresh & 0x1F) << 20
+                     | out_shiftdir << 19 | in_shiftdir << 18 | autopull << 17 | autopush << 16)
+        self.prog = [[], -1, -1, 0, shiftctrl, out_init, set_init, sideset_init]
+        self.wrap_used = False
+        if sideset_init is None:
+            self.sideset_count = 0
+        elif isinstance(sideset_init, int):
+            self.sideset_count = 1
+        else:
+            self.sideset_count = len(sideset_init)
+
+    def start_pass(self, pass_):
+        if pass_ == 1:
+            if not self.wrap_used and self.num_instr:
+                self.wrap()
+            self.delay_max = 31
+            if self.sideset_count:
+                self.sideset_opt = self.num_sideset != self.num_instr
+                if self.sideset_opt:
+                    self.prog[_PROG_EXECCTRL] |= 1 << 30
+                    self.sideset_count += 1
+                self.delay_max >>= self.sideset_count
+        self.pass_ = pass_
+        self.num_instr = 0
+        self.num_sideset = 0
+
+    def __getitem__(self, key):
+        return self.delay(key)
+
+    def delay(self, delay):
+        if self.pass_ > 0:
+            if delay > self.delay_max:
+                raise PIOASMError('delay too large')
+            self.prog[_PROG_DATA][-1] |= delay << 8
+        return self
+
+    def side(self, value):
+        self.num_sideset += 1
+        if self.pass_ > 0:
+            if self.sideset_count == 0:
+                raise PIOASMError('no sideset')
+            elif value >= (1 << self.sideset_count):
+                raise PIOASMError('sideset too large')
+            set_bit = 13 - self.sideset_count
+            self.prog[_PROG_DATA][-1] |= self.sideset_opt << 12 | value << set_bit
+        return self
+
+    def wrap_target(self):
+        self.prog[_PROG_EXECCTRL] |= self.num_instr << 7
+
+    def wrap(self):
+        assert self.num_instr
+        self.prog[_PROG_EXECCTRL] |= (self.num_instr - 1) << 12
+        self.wrap_used = True
+
+    def label(self, label):
+        if self.pass_ == 0:
+            if label in self.labels:
+                raise PIOASMError(f'duplicate label {label}')
+            self.labels[label] = self.num_instr
+
+    def word(self, instr, label=None):
+        # Labels are resolved on the second pass, so jumps can go forward
+        self.num_instr += 1
+        if self.pass_ > 0:
+            if label is None:
+                label = 0
+            else:
+                if label not in self.labels:
+                    raise PIOASMError(f'unknown label {label}')
+                label = self.labels[label]
+            if self.num_instr > 32:
+                raise PIOASMError('too many instructions')
+            self.prog[_PROG_DATA].append(instr | label)
+        return self
+
+    def nop(self):
+        return self.word(0xA042)
+
+    def jmp(self, cond, label=None):
+        if label is None:
+            label = cond
+            cond = 0
+        return self.word(0x0000 | cond << 5, label)
+
+    def wait(self, polarity, src, index):
+        if src == 6:
+            src = 1  # "pin"
+        elif src != 0:
+            src = 2  # "irq"
+        return self.word(0x2000 | polarity << 7 | src << 5 | index)
+
+    def in_(self, src, data):
+        if not 0 < data <= 32:
+            raise PIOASMError(f'invalid bit count {data}')
+        return self.word(0x4000 | src << 5 | data & 0x1F)
+
+    def out(self, dest, data):
+        if dest == 8:
+            dest = 7  # exec
+        if not 0 < data <= 32:
+            raise PIOASMError(f'invalid bit count {data}')
+        return self.word(0x6000 | dest << 5 | data & 0x1F)
+
+    def push(self, value=0, value2=0):
+        value |= value2
+        if not value & 1:
+            value |= 0x20
+        return self.word(0x8000 | (value & 0x60))
+
+    def pull(self, value=0, value2=0):
+        value |= value2
+        if not value & 1:
+            value |= 0x20
+        return self.word(0x8080 | (value & 0x60))
+
+    def mov(self, dest, src):
+        if dest == 8:
+            dest = 4  # exec
+        return self.word(0xA000 | dest << 5 | src)
+
+    def irq(self, mod, index=None):
+        if index is None:
+            index = mod
+            mod = 0
+        return self.word(0xC000 | (mod & 0x60) | index)
+
+    def set(self, dest, data):
+        return self.word(0xE000 | dest << 5 | data)
+
+
+_pio_funcs = {
+    'gpio': 0,
+    'pins': 0,
+    'x': 1,
+    'y': 2,
+    'null': 3,
+    'pindirs': 4,
+    'pc': 5,
+    'status': 5,
+    'isr': 6,
+    'osr': 7,
+    'exec': 8,
+    'invert': lambda x: x | 0x08,
+    'reverse': lambda x: x | 0x10,
+    'not_x': 1,
+    'x_dec': 2,
+    'not_y': 3,
+    'y_dec': 4,
+    'x_not_y': 5,
+    'pin': 6,
+    'not_osre': 7,
+    'noblock': 0x01,
+    'block': 0x21,
+    'iffull': 0x40,
+    'ifempty': 0x40,
+    'clear': 0x40,
+    'rel': lambda x: x | 0x10,
+}
+
+
+def asm_pio(**kw):
+    emit = PIOASMEmit(**kw)
+
+    def dec(f):
+        # On the device the program body only sees _pio_funcs, plus whatever
+        # const() values the compiler folded in; int globals stand in for those
+        gl = {name: value for name, value in f.__globals__.items() if type(value) is int}
+        gl.update(_pio_funcs)
+        for name in ('wrap_target', 'wrap', 'label', 'word', 'nop', 'jmp', 'wait', 'in_', 'out',
+                     'push', 'pull', 'mov', 'irq', 'set'):
+            gl[name] = getattr(emit, name)
+        gl['__builtins__'] = __builtins__
+        body = types.FunctionType(f.__code__, gl, f.__name__, f.__defaults__, f.__closure__)
+
+        emit.start_pass(0)
+        body()
+        emit.start_pass(1)
+        body()
+        return emit.prog
+
+    return dec
+
+
+class GPIO:
+    def __init__(self, sim, count=30):
+        self.sim = sim
+        self.count = count
+        self.out = [0] * count
+        self.oe = [False] * count
+        self.external = [None] * count
+        self.pull = [0] * count
+        self.function = [None] * count
+        self.listeners = []
+        self._held = None
+
+    def value(self, pin):
+        pin %= 32
+        if pin >= self.count:
+            return 0
+        if self.oe[pin]:
+            return self.out[pin]
+        level = self.external[pin]
+        return self.pull[pin] if level is None else level
+
+    def _changed(self, pin):
+        if self._held is not None:
+            if pin not in self._held:
+                self._held.append(pin)
+            return
+        for listener in self.listeners:
+            listener(self.sim.now, pin)
+
+    def hold(self):
+        # Everything a state machine drives in one cycle changes at once:
+        # listeners hear about it after the cycle, with all pins settled
+        self._held = []
+
+    def release(self):
+        held, self._held = self._held, None
+        for pin in held or ():
+            self._changed(pin)
+
+    def drive(self, owner, pin, value):
+        pin %= 32
+        if pin >= self.count or self.function[pin] != owner:
+            return
+        if self.out[pin] != value:
+            self.out[pin] = value
+            if self.oe[pin]:
+                self._changed(pin)
+
+    def direction(self, owner, pin, output):
+        pin %= 32
+        if pin >= self.count or self.function[pin] != owner:
+            return
+        if self.oe[pin] != output:
+            before = self.value(pin)
+            self.oe[pin] = output
+            if self.value(pin) != before:
+                self._changed(pin)
+
+    def set_external(self, pin, level):
+        before = self.value(pin)
+        self.external[pin] = level
+        if self.value(pin) != before:
+            self._changed(pin)
+
+
+class Instruction:
+    __slots__ = ('op', 'side', 'delay', 'a', 'b', 'c', 'word')
+
+    def __init__(self, word, sideset_count, side_opt):
+        self.word = word
+        self.op = word >> 13
+        field = (word >> 8) & 0x1F
+        delay_bits = 5 - sideset_count
+        self.delay = field & ((1 << delay_bits) - 1)
+        self.side = None
+        if sideset_count:
+            side = field >> delay_bits
+            if side_opt:
+                if side >> (sideset_count - 1):
+                    self.side = side & ((1 << (sideset_count - 1)) - 1)
+            else:
+                self.side = side
+        self.a = (word >> 5) & 0x7
+        self.b = word & 0x1F
+        self.c = word & 0xFF
+
+
+class StateMachineSim:
+    def __init__(self, block, index):
+        self.block = block
+        self.index = index
+        self.enabled = False
+        self.program = None
+        self.reset_config()
+
+    def reset_config(self):
+        self.instructions = []
+        self.period = SUBCYCLES
+        self.wrap_bottom = 0
+        self.wrap_top = 31
+        self.sideset_count = 0
+        self.side_opt = False
+        self.side_pindir = False
+        self.side_base = 0
+        self.in_base = self.out_base = self.set_base = 0
+        self.out_count = self.set_count = 0
+        self.jmp_pin = 0
+        self.in_right = self.out_right = False
+        self.autopush = self.autopull = False
+        self.push_thresh = self.pull_thresh = 32
+        self.fifo_depth_tx = self.fifo_depth_rx = 4
+        self.status_rx = False
+        self.status_n = 0
+        self.restart()
+        self.tx = deque()
+        self.rx = deque()
+        self.pc = 0
+
+    def restart(self):
+        self.x = self.y = 0
+        self.isr = 0
+        self.isr_count = 0
+        self.osr = 0
+        self.osr_count = 32
+        self.delay = 0
+        self.stalled = None
+        self.side_done = False
+        self.exec_pending = None
+        self.stall_cycles = 0
+        self.cycles = 0
+
+    def configure(self, prog, freq, in_base, out_base, set_base, jmp_pin, sideset_base,
+                  in_shiftdir, out_shiftdir, push_thresh, pull_thresh):
+        execctrl = prog[_PROG_EXECCTRL]
+        shiftctrl = prog[_PROG_SHIFTCTRL]
+        self.reset_config()
+        self.program = prog
+        self.period = max(SUBCYCLES, round(self.block.sim.sys_freq * SUBCYCLES / freq))
+        self.wrap_bottom = (execctrl >> 7) & 0x1F
+        self.wrap_top = (execctrl >> 12) & 0x1F
+        self.side_opt = bool(execctrl & (1 << 30))
+        sideset_pins = prog[_PROG_SIDESET_PINS]
+        if sideset_pins is None:
+            side_pins = 0
+        elif isinstance(sideset_pins, int):
+            side_pins = 1
+        else:
+            side_pins = len(sideset_pins)
+        self.sideset_count = side_pins + (1 if self.side_opt and side_pins else 0)
+        self.side_base = sideset_base or 0
+        self.in_base = in_base or 0
+        self.out_base = out_base or 0
+        self.set_base = set_base or 0
+        self.jmp_pin = jmp_pin or 0
+        self.out_count = self._pin_count(prog[_PROG_OUT_PINS])
+        self.set_count = self._pin_count(prog[_PROG_SET_PINS])
+        fifo_join = (shiftctrl >> 30) & 3
+        pull = (shiftctrl >> 25) & 0x1F
+        push = (shiftctrl >> 20) & 0x1F
+        self.pull_thresh = pull_thresh if pull_thresh is not None else (pull or 32)
+        self.push_thresh = push_thresh if push_thresh is not None else (push or 32)
+        self.out_right = bool(out_shiftdir if out_shiftdir is not None else (shiftctrl >> 19) & 1)
+        self.in_right = bool(in_shiftdir if in_shiftdir is not None else (shiftctrl >> 18) & 1)
+        self.autopull = bool((shiftctrl >> 17) & 1)
+        self.autopush = bool((shiftctrl >> 16) & 1)
+        self.fifo_depth_tx = 8 if fifo_join == 1 else 0 if fifo_join == 2 else 4
+        self.fifo_depth_rx = 8 if fifo_join == 2 else 0 if fifo_join == 1 else 4
+        self.instructions = [Instruction(word, self.sideset_count, self.side_opt) for word in prog[_PROG_DATA]]
+        self.pc = 0
+
+        gpio = self.block.sim.gpio
+        owner = self.block.owner
+        for base, init in ((self.out_base, prog[_PROG_OUT_PINS]), (self.set_base, prog[_PROG_SET_PINS]),
+                           (self.side_base, sideset_pins)):
+            if init is None:
+                continue
+            for i, state in enumerate((init,) if isinstance(init, int) else init):
+                pin = (base + i) % 32
+                if pin < gpio.count:
+                    gpio.function[pin] = owner
+                    gpio.drive(owner, pin, state & 1)
+                    gpio.direction(owner, pin, bool(state >> 1))
+
+    @staticmethod
+    def _pin_count(init):
+        if init is None:
+            return 0
+        return 1 if isinstance(init, int) else len(init)
+
+    # ---- pins
+
+    def _write_pins(self, base, count, value):
+        gpio = self.block.sim.gpio
+        owner = self.block.owner
+        for i in range(count):
+            gpio.drive(owner, base + i, (value >> i) & 1)
+
+    def _write_dirs(self, base, count, value):
+        gpio = self.block.sim.gpio
+        owner = self.block.owner
+        for i in range(count):
+            gpio.direction(owner, base + i, bool((value >> i) & 1))
+
+    def _read_pins(self, base, count=32):
+        gpio = self.block.sim.gpio
+        value = 0
+        for i in range(count):
+            value |= gpio.value(base + i) << i
+        return value
+
+    # ---- shift registers
+
+    def _shift_in(self, data, count):
+        count = count or 32
+        data &= (1 << count) - 1 if count < 32 else 0xFFFFFFFF
+        if self.in_right:
+            self.isr = ((self.isr >> count) | (data << (32 - count))) & 0xFFFFFFFF if count < 32 else data
+        else:
+            self.isr = ((self.isr << count) | data) & 0xFFFFFFFF if count < 32 else data
+        self.isr_count = min(32, self.isr_count + count)
+
+    def _shift_out(self, count):
+        count = count or 32
+        if self.out_right:
+            data = self.osr & ((1 << count) - 1) if count < 32 else self.osr
+            self.osr = self.osr >> count if count < 32 else 0
+        else:
+            data = self.osr >> (32 - count) if count < 32 else self.osr
+            self.osr = (self.osr << count) & 0xFFFFFFFF if count < 32 else 0
+        self.osr_count = min(32, self.osr_count + count)
+        return data
+
+    def _fetch(self, value):
+        self.osr = value & 0xFFFFFFFF
+        self.osr_count = 0
+
+    def _irq_index(self, index):
+        if index & 0x10:
+            return (index & 0x4) | ((index + self.index) & 0x3)
+        return index & 0x7
+
+    def _status(self):
+        if self.status_rx:
+            return 0xFFFFFFFF if len(self.rx) < self.status_n else 0
+        return 0xFFFFFFFF if len(self.tx) < self.status_n else 0
+
+    # ---- execution
+
+    def step(self):
+        # One cycle of this state machine's clock
+        self.cycles += 1
+        if self.delay:
+            self.delay -= 1
+            return
+        if self.exec_pending is not None:
+            instr = self.exec_pending
+            from_exec = True
+        else:
+            instr = self.instructions[self.pc]
+            from_exec = False
+        gpio = self.block.sim.gpio
+        gpio.hold()
+        jumped = self.execute(instr)
+        # Side-set lands in the same cycle, and wins over the instruction's
+        # own pin writes; a stalled instruction only sets it the first time
+        if not self.side_done and instr.side is not None:
+            if self.side_pindir:
+                self._write_dirs(self.side_base, self.sideset_count - self.side_opt, instr.side)
+            else:
+                self._write_pins(self.side_base, self.sideset_count - self.side_opt, instr.side)
+        self.side_done = True
+        gpio.release()
+        if jumped is None:
+            self.stall_cycles += 1
+            return
+        self.side_done = False
+        self.delay = instr.delay
+        if from_exec:
+            self.exec_pending = None
+        elif not jumped:
+            self.pc = self.wrap_bottom if self.pc == self.wrap_top else (self.pc + 1) % 32
+        if self.pc >= len(self.instructions):
+            self.pc = 0
+
+    def execute(self, instr):
+        # Returns None if the instruction stalls, else whether it moved the PC
+        op = instr.op
+        if op == 0:  # JMP
+            cond = instr.a
+            if cond == 0:
+                take = True
+            elif cond == 1:
+                take = self.x == 0
+            elif cond == 2:
+                take = self.x != 0
+                self.x = (self.x - 1) & 0xFFFFFFFF
+            elif cond == 3:
+                take = self.y == 0
+            elif cond == 4:
+                take = self.y != 0
+                self.y = (self.y - 1) & 0xFFFFFFFF
+            elif cond == 5:
+                take = self.x != self.y
+            elif cond == 6:
+                take = bool(self.block.sim.gpio.value(self.jmp_pin))
+            else:
+                take = self.osr_count < self.pull_thresh
+            if take:
+                self.pc = instr.b
+            return take
+
+        if op == 1:  # WAIT
+            polarity = (instr.c >> 7) & 1
+            source = (instr.c >> 5) & 3
+            index = instr.b
+            if source == 0:
+                level = self.block.sim.gpio.value(index)
+            elif source == 1:
+                level = self.block.sim.gpio.value(self.in_base + index)
+            else:
+                flag = self._irq_index(index)
+                level = self.block.irq_flags >> flag & 1
+                if level and polarity:
+                    self.block.irq_flags &= ~(1 << flag)
+                    return False
+            return False if level == polarity else None
+
+        if op == 2:  # IN
+            source = instr.a
+            count = instr.b or 32
+            if self.autopush and self.isr_count + count >= self.push_thresh and len(self.rx) >= self.fifo_depth_rx:
+                return None
+            if source == 0:
+                data = self._read_pins(self.in_base, count)
+            elif source == 1:
+                data = self.x
+            elif source == 2:
+                data = self.y
+            elif source == 3:
+                data = 0
+            elif source == 6:
+                data = self.isr
+            elif source == 7:
+                data = self.osr
+            else:
+                data = 0
+            self._shift_in(data, count)
+            if self.autopush and self.isr_count >= self.push_thresh:
+                self.rx.append(self.isr)
+                self.isr = 0
+                self.isr_count = 0
+            return False
+
+        if op == 3:  # OUT
+            dest = instr.a
+            count = instr.b or 32
+            if self.autopull and self.osr_count >= self.pull_thresh:
+                if not self.tx:
+                    return None
+                self._fetch(self.tx.popleft())
+                self.block.sim.refill(self)
+            data = self._shift_out(count)
+            if dest == 0:
+                self._write_pins(self.out_base, self.out_count, data)
+            elif dest == 1:
+                self.x = data
+            elif dest == 2:
+                self.y = data
+            elif dest == 4:
+                self._write_dirs(self.out_base, self.out_count, data)
+            elif dest == 5:
+                self.pc = data & 0x1F
+                return True
+            elif dest == 6:
+                self.isr = data
+                self.isr_count = count
+            elif dest == 7:
+                self.exec_pending = Instruction(data & 0xFFFF, self.sideset_count, self.side_opt)
+                return True
+            return False
+
+        if op == 4:  # PUSH / PULL
+            if_flag = (instr.c >> 6) & 1
+            block = (instr.c >> 5) & 1
+            if instr.c & 0x80:  # PULL
+                if if_flag and self.osr_count < self.pull_thresh:
+                    return False
+                if self.tx:
+                    self._fetch(self.tx.popleft())
+                    self.block.sim.refill(self)
+                    return False
+                if block:
+                    return None
+                self._fetch(self.x)
+                return False
+            if if_flag and self.isr_count < self.push_thresh:
+                return False
+            if len(self.rx) >= self.fifo_depth_rx:
+                if block:
+                    return None
+                return False
+            self.rx.append(self.isr)
+            self.isr = 0
+            self.isr_count = 0
+            return False
+
+        if op == 5:  # MOV
+            dest = instr.a
+            operation = (instr.c >> 3) & 3
+            source = instr.c & 7
+            if source == 0:
+                data = self._read_pins(self.in_base)
+            elif source == 1:
+                data = self.x
+            elif source == 2:
+                data = self.y
+            elif source == 3:
+                data = 0
+            elif source == 5:
+                data = self._status()
+            elif source == 6:
+                data = self.isr
+            elif source == 7:
+                data = self.osr
+            else:
+                data = 0
+            if operation == 1:
+                data = ~data & 0xFFFFFFFF
+            elif operation == 2:
+                data = int(f'{data:032b}'[::-1], 2)
+            if dest == 0:
+                self._write_pins(self.out_base, self.out_count, data)
+            elif dest == 1:
+                self.x = data
+            elif dest == 2:
+                self.y = data
+            elif dest == 4:
+                self.exec_pending = Instruction(data & 0xFFFF, self.sideset_count, self.side_opt)
+                return True
+            elif dest == 5:
+                self.pc = data & 0x1F
+                return True
+            elif dest == 6:
+                self.isr = data
+                self.isr_count = 0
+            elif dest == 7:
+                self.osr = data
+                self.osr_count = 0
+            return False
+
+        if op == 6:  # IRQ
+            clear = (instr.c >> 6) & 1
+            wait = (instr.c >> 5) & 1
+            flag = self._irq_index(instr.b)
+            if self.stalled is instr:
+                if self.block.irq_flags >> flag & 1:
+                    return None
+                self.stalled = None
+                return False
+            if clear:
+                self.block.irq_flags &= ~(1 << flag)
+                return False
+            self.block.irq_flags |= 1 << flag
+            self.block.raise_irq(flag)
+            if wait:
+                self.stalled = instr
+                return None
+            return False
+
+        # SET
+        dest = instr.a
+        data = instr.b
+        if dest == 0:
+            self._write_pins(self.set_base, self.set_count, data)
+        elif dest == 1:
+            self.x = data
+        elif dest == 2:
+            self.y = data
+        elif dest == 4:
+            self._write_dirs(self.set_base, self.set_count, data)
+        return False
+
+
+class PIOBlock:
+    def __init__(self, sim, number):
+        self.sim = sim
+        self.number = number
+        self.owner = f'pio{number}'
+        self.irq_flags = 0
+        self.irq_handlers = {}
+        self.state_machines = [StateMachineSim(self, i) for i in range(4)]
+        self.programs = {}
+
+    def raise_irq(self, flag):
+        # Flags 0-3 interrupt the CPU if a handler is set; it clears the flag
+        # and runs the handler later, as a soft IRQ
+        handler = self.irq_handlers.get(flag)
+        if handler is not None:
+            self.irq_flags &= ~(1 << flag)
+            sim = self.sim
+            sim.call_at(sim.now + sim.time_from_seconds(_StateMachine.irq_latency), handler)
+
+    def add_program(self, prog):
+        key = id(prog)
+        if key not in self.programs:
+            used = sum(len(p[_PROG_DATA]) for p in self.programs.values())
+            if used + len(prog[_PROG_DATA]) > 32:
+                raise OSError(12, f'PIO{self.number} instruction memory full')
+            self.programs[key] = prog
+
+    def remove_program(self, prog=None):
+        if prog is None:
+            self.programs.clear()
+        else:
+            self.programs.pop(id(prog), None)
+
+
+class _Event:
+    # A one-off entry in the simulator's queue, scheduled like a state machine
+    enabled = True
+    period = 0
+
+    def __init__(self, callback):
+        self.callback = callback
+
+    def step(self):
+        self.enabled = False
+        self.callback()
+
+
+class Simulator:
+    def __init__(self, sys_freq=125_000_000):
+        self.sys_freq = sys_freq
+        self.now = 0
+        self.gpio = GPIO(self)
+        self.blocks = [PIOBlock(self, 0), PIOBlock(self, 1)]
+        self._queue = []
+        self._order = 0
+        self.tx_sources = {}
+        self.rx_sinks = {}
+        self.interpolators = [Interpolator(), Interpolator()]
+        # (address, buffer, bytes) of buffers that uctypes.addressof has
+        # placed in a made up SRAM, so viper can point at them by address
+        self.buffers = []
+
+    def address_of(self, buffer):
+        for address, known, _ in self.buffers:
+            if known is buffer:
+                return address
+        address = _SRAM_BASE
+        if self.buffers:
+            address, _, view = self.buffers[-1]
+            address = (address + len(view) + 7) & ~7
+        self.buffers.append((address, buffer, memoryview(buffer).cast('B')))
+        return address
+
+    def memory_at(self, address):
+        for start, _, view in self.buffers:
+            if start <= address < start + len(view):
+                return view[address - start:]
+        raise NotImplementedError(f'no model of memory at 0x{address:08x}')
+
+    def seconds(self, time=None):
+        return (self.now if time is None else time) / (SUBCYCLES * self.sys_freq)
+
+    def time_from_seconds(self, seconds):
+        return round(seconds * SUBCYCLES * self.sys_freq)
+
+    def state_machine(self, number):
+        return self.blocks[number // 4].state_machines[number % 4]
+
+    def activate(self, sm, active):
+        if active and not sm.enabled:
+            sm.enabled = True
+            self._order += 1
+            heapq.heappush(self._queue, (self.now, sm.block.number * 4 + sm.index, self._order, sm))
+        elif not active:
+            sm.enabled = False
+
+    def feed(self, sm, words):
+        # DMA stand-in: keeps the TX FIFO topped up from an iterable of words
+        self.tx_sources[sm] = iter(words)
+        self.refill(sm)
+
+    def drain(self, sm, sink):
+        # DMA stand-in: moves every RX FIFO word into sink.append
+        self.rx_sinks[sm] = sink
+
+    def drain_rx(self, sm):
+        # A sink can remove itself (a DMA finishing its count), leaving the
+        # rest of the FIFO for whatever drains it next
+        sink = self.rx_sinks.get(sm)
+        while sink is not None and sm.rx:
+            sink(sm.rx.popleft())
+            sink = self.rx_sinks.get(sm)
+
+    def call_at(self, time, callback):
+        # Runs callback() at a simulated time, in step with the state machines
+        self._order += 1
+        heapq.heappush(self._queue, (time, 8, self._order, _Event(callback)))
+
+    def play(self, changes, start=None):
+        # Drives pins from outside the chip: changes yields (delay in seconds,
+        # {pin: level}) pairs, each applied that long after the one before
+        changes = iter(changes)
+
+        def apply(levels):
+            for pin, level in levels.items():
+                self.gpio.set_external(pin, level)
+
+        def next_change(time):
+            for delay, levels in changes:
+                if delay > 0:
+                    time += self.time_from_seconds(delay)
+                    self.call_at(time, lambda: (apply(levels), next_change(time)))
+                    return
+                apply(levels)
+
+        next_change(self.now if start is None else start)
+
+    def refill(self, sm):
+        source = self.tx_sources.get(sm)
+        if source is None:
+            return
+        while len(sm.tx) < sm.fifo_depth_tx:
+            try:
+                sm.tx.append(next(source) & 0xFFFFFFFF)
+            except StopIteration:
+                del self.tx_sources[sm]
+                return
+
+    def run_until(self, end_time=None, condition=None, max_steps=None):
+        # Steps the enabled state machines in time order until end_time, until
+        # condition() is true, or until nothing is left to run
+        steps = 0
+        queue = self._queue
+        while queue:
+            time, number, order, sm = queue[0]
+            if end_time is not None and time > end_time:
+                break
+            heapq.heappop(queue)
+            if not sm.enabled:
+                continue
+            self.now = time
+            sm.step()
+            self.drain_rx(sm)
+            heapq.heappush(queue, (time + sm.period, number, order, sm))
+            steps += 1
+            if condition is not None and condition():
+                return True
+            if max_steps is not None and steps >= max_steps:
+                break
+        if end_time is not None and end_time > self.now:
+            self.now = end_time
+        return condition() if condition is not None else False
+
+    def run_for(self, seconds):
+        return self.run_until(self.now + self.time_from_seconds(seconds))
+
+
+# ---- MicroPython module stand-ins
+
+_current = None
+
+
+class _PIO:
+    IN_LOW = 0
+    IN_HIGH = 1
+    OUT_LOW = 2
+    OUT_HIGH = 3
+    SHIFT_LEFT = 0
+    SHIFT_RIGHT = 1
+    JOIN_NONE = 0
+    JOIN_TX = 1
+    JOIN_RX = 2
+    IRQ_SM0 = 0x100
+    IRQ_SM1 = 0x200
+    IRQ_SM2 = 0x400
+    IRQ_SM3 = 0x800
+
+    def __init__(self, number):
+        self.block = _current.blocks[number]
+
+    def add_program(self, prog):
+        self.block.add_program(prog)
+
+    def remove_program(self, prog=None):
+        self.block.remove_program(prog)
+
+    def state_machine(self, index, *args, **kwargs):
+        return _StateMachine(self.block.number * 4 + index, *args, **kwargs)
+
+
+class _StateMachine:
+    irq_latency = 20e-6
+
+    def __init__(self, number, program=None, **kwargs):
+        self.number = number
+        self.sim = _current
+        self.sm = _current.state_machine(number)
+        if program is not None:
+            self.init(program, **kwargs)
+
+    def init(self, program, freq=None, *, in_base=None, out_base=None, set_base=None, jmp_pin=None,
+             sideset_base=None, in_shiftdir=None, out_shiftdir=None, push_thresh=None, pull_thresh=None):
+        self.sim.activate(self.sm, False)
+        self.sm.block.add_program(program)
+        self.sm.configure(program, freq or self.sim.sys_freq, _pin_number(in_base), _pin_number(out_base),
+                          _pin_number(set_base), _pin_number(jmp_pin), _pin_number(sideset_base),
+                          in_shiftdir, out_shiftdir, push_thresh, pull_thresh)
+
+    def active(self, value=None):
+        if value is None:
+            return self.sm.enabled
+        self.sim.activate(self.sm, bool(value))
+
+    def restart(self):
+        self.sm.restart()
+
+    def exec(self, instr):
+        emit = PIOASMEmit(sideset_init=(0,) * (self.sm.sideset_count - self.sm.side_opt) or None)
+        emit.start_pass(0)
+        emit.start_pass(1)
+        emit.sideset_opt = self.sm.side_opt
+        if self.sm.side_opt:
+            emit.sideset_count = self.sm.sideset_count
+        gl = dict(_pio_funcs)
+        for name in ('nop', 'jmp', 'wait', 'in_', 'out', 'push', 'pull', 'mov', 'irq', 'set'):
+            gl[name] = getattr(emit, name)
+        emit.labels = {}
+        eval(instr, gl)
+        self.sm.exec_pending = Instruction(emit.prog[_PROG_DATA][-1], self.sm.sideset_count, self.sm.side_opt)
+        jumped = self.sm.execute(self.sm.exec_pending)
+        if jumped is not None:
+            self.sm.exec_pending = None
+
+    def put(self, value, shift=0):
+        values = [value] if isinstance(value, int) else value
+        for item in values:
+            sm = self.sm
+            if len(sm.tx) >= sm.fifo_depth_tx:
+                self.sim.run_until(condition=lambda: len(sm.tx) < sm.fifo_depth_tx)
+            sm.tx.append((item << shift) & 0xFFFFFFFF)
+
+    def get(self, buf=None, shift=0):
+        sm = self.sm
+        if not sm.rx:
+            self.sim.run_until(condition=lambda: bool(sm.rx))
+        return sm.rx.popleft() >> shift
+
+    def rx_fifo(self):
+        return len(self.sm.rx)
+
+    def tx_fifo(self):
+        return len(self.sm.tx)
+
+    def irq(self, handler=None, trigger=0, hard=False):
+        # handler(state machine) runs when the program raises irq(rel(0))
+        handlers = self.sm.block.irq_handlers
+        if handler is None:
+            handlers.pop(self.sm.index, None)
+        else:
+            handlers[self.sm.index] = lambda: handler(self)
+
+
+class _DMA:
+    # Only what a PIO receiver needs: words from a state machine's RX FIFO
+    # (given by its register address, as on the chip) into a buffer, with
+    # the completion IRQ called irq_latency later, as a soft IRQ would be.
+    # Control words are kept as dicts rather than packed
+    _PIO_RX_FIFOS = {base + 0x20 + 4 * i: block * 4 + i
+                     for block, base in enumerate((0x50200000, 0x50300000)) for i in range(4)}
+    _channels = 0
+    irq_latency = 20e-6
+
+    def __init__(self):
+        self.channel = _DMA._channels
+        _DMA._channels += 1
+        self.sim = _current
+        self.read = self.write = None
+        self.count = 0
+        self.ctrl = self.pack_ctrl()
+        self._handler = None
+        self._busy = False
+        self._sm = None
+
+    def pack_ctrl(self, default=None, **kwargs):
+        ctrl = dict(default or {'size': 2, 'inc_read': True, 'inc_write': True, 'treq_sel': 0x3F,
+                                'chain_to': self.channel, 'enable': True})
+        ctrl.update(kwargs)
+        return ctrl
+
+    def config(self, read=None, write=None, count=None, ctrl=None, trigger=False):
+        # The chip changes a running channel's registers under it and ignores
+        # the trigger; it has to be stopped first
+        if self._busy:
+            raise RuntimeError('DMA channel %d configured while busy' % self.channel)
+        if read is not None:
+            self.read = read
+        if write is not None:
+            self.write = write
+        if count is not None:
+            self.count = count
+        if ctrl is not None:
+            self.ctrl = ctrl
+        if trigger:
+            self.active(1)
+
+    def active(self, value=None):
+        if value is None:
+            return self._busy
+        if not value:
+            if self._sm is not None and self.sim.rx_sinks.get(self._sm) == self._take:
+                del self.sim.rx_sinks[self._sm]
+            self._busy = False
+            return
+        number = self._PIO_RX_FIFOS.get(self.read)
+        if number is None or isinstance(self.write, int) or self.ctrl['size'] != 2 or self.ctrl['inc_read']:
+            raise NotImplementedError('the DMA stand-in only moves PIO RX FIFO words into a buffer')
+        self._view = memoryview(self.write).cast('B')
+        self._offset = 0
+        self._busy = self.count > 0
+        if self._busy:
+            self._sm = self.sim.state_machine(number)
+            self.sim.rx_sinks[self._sm] = self._take
+            self.sim.drain_rx(self._sm)
+
+    def _take(self, word):
+        self._view[self._offset:self._offset + 4] = word.to_bytes(4, 'little')
+        if self.ctrl['inc_write']:
+            self._offset += 4
+        self.count -= 1
+        if self.count == 0:
+            self.active(0)
+            if self._handler is not None:
+                self.sim.call_at(self.sim.now + self.sim.time_from_seconds(self.irq_latency),
+                                 lambda: self._handler(self))
+
+    def irq(self, handler=None, hard=False):
+        self._handler = handler
+
+    def close(self):
+        self.active(0)
+        self._handler = None
+
+
+class Interpolator:
+    # One of the SIO interpolators, enough for table walks: each lane's
+    # result is BASEn plus ACCUMn shifted, masked and optionally sign
+    # extended (or ACCUMn as it is with ADD_RAW); a POP writes both results
+    # back to the accumulators.  Cross input/result, BASE2 and blend are not
+    # modelled
+    REGISTERS = ('ACCUM0', 'ACCUM1', 'BASE0', 'BASE1', 'BASE2', 'POP_LANE0', 'POP_LANE1', 'POP_FULL',
+                 'PEEK_LANE0', 'PEEK_LANE1', 'PEEK_FULL', 'CTRL_LANE0', 'CTRL_LANE1', 'ACCUM0_ADD',
+                 'ACCUM1_ADD', 'BASE_1AND0')
+
+    def __init__(self):
+        self.accum = [0, 0]
+        self.base = [0, 0, 0]
+        self.ctrl = [0, 0]
+
+    def _result(self, lane):
+        ctrl = self.ctrl[lane]
+        if (ctrl >> 18) & 1:
+            value = self.accum[lane]
+        else:
+            shift = ctrl & 31
+            lsb = (ctrl >> 5) & 31
+            msb = (ctrl >> 10) & 31
+            mask = ((1 << (msb + 1)) - 1) & ~((1 << lsb) - 1)
+            value = (self.accum[lane] >> shift) & mask
+            if (ctrl >> 15) & 1 and (value >> msb) & 1:
+                value |= ~((1 << (msb + 1)) - 1)
+        return (value + self.base[lane]) & 0xFFFFFFFF
+
+    def __getitem__(self, index):
+        name = self.REGISTERS[index]
+        if name in ('ACCUM0', 'ACCUM1'):
+            return self.accum[index]
+        if name.startswith('PEEK') or name.startswith('POP'):
+            results = [self._result(0), self._result(1)]
+            value = (results + [self.base[2]])[('LANE0', 'LANE1', 'FULL').index(name.split('_')[1])]
+            if name.startswith('POP'):
+                self.accum = results
+            return value
+        if name.startswith('CTRL'):
+            return self.ctrl[int(name[-1])]
+        if name.startswith('BASE') and name != 'BASE_1AND0':
+            return self.base[int(name[-1])]
+        return 0
+
+    def __setitem__(self, index, value):
+        name = self.REGISTERS[index]
+        value &= 0xFFFFFFFF
+        if name in ('ACCUM0', 'ACCUM1'):
+            self.accum[index] = value
+        elif name in ('ACCUM0_ADD', 'ACCUM1_ADD'):
+            lane = int(name[5])
+            self.accum[lane] = (self.accum[lane] + value) & 0xFFFFFFFF
+        elif name.startswith('CTRL'):
+            self.ctrl[int(name[-1])] = value
+        elif name == 'BASE_1AND0':
+            self.base[0] = value & 0xFFFF
+            self.base[1] = value >> 16
+        elif name.startswith('BASE'):
+            self.base[int(name[-1])] = value
+
+
+_SIO_INTERP = {0xD0000080: 0, 0xD00000C0: 1}
+
+
+def _ptr(typecode):
+    # Viper's ptr8/ptr16/ptr32 over a buffer, over an SIO interpolator's
+    # registers, or at an address from uctypes.addressof
+    size = {'B': 1, 'H': 2, 'I': 4}[typecode]
+
+    def ptr(target):
+        if isinstance(target, int):
+            if target in _SIO_INTERP:
+                return _current.interpolators[_SIO_INTERP[target]]
+            view = _current.memory_at(target)
+            return view[:len(view) - len(view) % size].cast(typecode)
+        return memoryview(target).cast('B').cast(typecode)
+    return ptr
+
+
+class _Pin:
+    IN = 0
+    OUT = 1
+    OPEN_DRAIN = 2
+    ALT = 3
+    PULL_UP = 1
+    PULL_DOWN = 2
+    IRQ_FALLING = 4
+    IRQ_RISING = 8
+
+    def __init__(self, id, mode=-1, pull=-1, *, value=None):
+        self.id = id
+        self.init(mode, pull, value=value)
+
+    def init(self, mode=-1, pull=-1, *, value=None):
+        gpio = _current.gpio
+        if pull != -1:
+            gpio.pull[self.id] = 1 if pull == self.PULL_UP else 0
+        if mode in (self.IN, self.OUT):
+            gpio.function[self.id] = 'sio'
+            if value is not None:
+                gpio.drive('sio', self.id, value)
+            gpio.direction('sio', self.id, mode == self.OUT)
+        elif value is not None:
+            gpio.drive('sio', self.id, value)
+
+    def value(self, value=None):
+        gpio = _current.gpio
+        if value is None:
+            return gpio.value(self.id)
+        gpio.drive('sio', self.id, 1 if value else 0)
+
+    __call__ = value
+
+    def on(self):
+        self.value(1)
+
+    def off(self):
+        self.value(0)
+
+    def __repr__(self):
+        return f'Pin(GPIO{self.id})'
+
+
+def _pin_number(pin):
+    if pin is None:
+        return None
+    return pin if isinstance(pin, int) else pin.id
+
+
+def _const(value):
+    return value
+
+
+def _decorator(f=None, *args, **kwargs):
+    return f if callable(f) else (lambda g: g)
+
+
+def _ticks(scale):
+    return lambda: int(_current.seconds() * scale) & _TICKS_MASK
+
+
+_TICKS_MASK = (1 << 30) - 1
+
+
+def _ticks_diff(end, start):
+    return ((end - start + (1 << 29)) & _TICKS_MASK) - (1 << 29)
+
+
+def _sleep(seconds):
+    # Sleeping lets the simulated hardware run for that long
+    _current.run_for(seconds)
+
+
+def install(sim):
+    # Makes sim the target of the stand-in modules, creating them if needed
+    global _current
+    _current = sim
+
+    rp2 = sys.modules.get('rp2')
+    if rp2 is None or not getattr(rp2, '_pio_sim', False):
+        rp2 = types.ModuleType('rp2')
+        rp2._pio_sim = True
+        rp2.asm_pio = asm_pio
+        rp2.PIOASMError = PIOASMError
+        rp2.PIO = _PIO
+        rp2.StateMachine = _StateMachine
+        rp2.DMA = _DMA
+        rp2._pio_funcs = _pio_funcs
+        sys.modules['rp2'] = rp2
+
+    machine = sys.modules.get('machine')
+    if machine is None or not getattr(machine, '_pio_sim', False):
+        machine = types.ModuleType('machine')
+        machine._pio_sim = True
+        machine.Pin = _Pin
+        sys.modules['machine'] = machine
+    machine.freq = lambda hz=None: _current.sys_freq if hz is None else setattr(_current, 'sys_freq', hz)
+
+    micropython = sys.modules.get('micropython')
+    if micropython is None or not getattr(micropython, '_pio_sim', False):
+        micropython = types.ModuleType('micropython')
+        micropython._pio_sim = True
+        micropython.const = _const
+        micropython.native = micropython.viper = _decorator
+        sys.modules['micropython'] = micropython
+
+    utime = sys.modules.get('utime')
+    if utime is None or not getattr(utime, '_pio_sim', False):
+        utime = types.ModuleType('utime')
+        utime._pio_sim = True
+        utime.ticks_us = _ticks(1_000_000)
+        utime.ticks_ms = _ticks(1_000)
+        utime.ticks_cpu = _ticks(sim.sys_freq)
+        utime.ticks_diff = _ticks_diff
+        utime.ticks_add = lambda ticks, delta: (ticks + delta) & _TICKS_MASK
+        utime.sleep = _sleep
+        utime.sleep_ms = lambda ms: _sleep(ms / 1_000)
+        utime.sleep_us = lambda us: _sleep(us / 1_000_000)
+        sys.modules['utime'] = utime
+
+    uctypes = sys.modules.get('uctypes')
+    if uctypes is None or not getattr(uctypes, '_pio_sim', False):
+        uctypes = types.ModuleType('uctypes')
+        uctypes._pio_sim = True
+        uctypes.addressof = lambda buffer: _current.address_of(buffer)
+        sys.modules['uctypes'] = uctypes
+
+    # Viper's pointer casts are builtins inside @micropython.viper functions
+    import builtins
+    builtins.ptr8, builtins.ptr16, builtins.ptr32 = _ptr('B'), _ptr('H'), _ptr('I')
+    builtins.uint = int
+
+    if LIB_DIR not in sys.path:
+        sys.path.insert(0, LIB_DIR)
+    return sim
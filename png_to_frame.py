@@ -1,77 +1,194 @@
 import configparser
 import os
-import numpy as np
+import time
 import cv2 as cv
-import sys
-
-'''
-
-Please go to "config.ini", located in the same directory as this file, to edit basic preferences.
 
+from frame_compiler import FrameCompiler, COLOR_MODULATION_MODES, SCAN_ORDERS
 
 '''
 
-cwd = os.path.dirname(sys.argv[0])
-
-os.chdir(cwd)
-
-read_parser = configparser.ConfigParser()
-read_parser.read('config.ini')
-
-try:
-    IMAGE_HEIGHT = read_parser.getint('dimensions', 'IMAGE_HEIGHT')
-    IMAGE_WIDTH = read_parser.getint('dimensions', 'IMAGE_WIDTH')
-    COLOR_MODULATION_MODE = read_parser.get('misc', 'COLOR_MODULATION_MODE')
-    WRITE_DIR = read_parser.get('files', 'WRITE_DIR')
-    READ_DIR = read_parser.get('files', 'READ_DIR')
-
-except:
-    raise ImportError("There was an issue importing data from 'config.ini', ensure neccessary data is there and of correct type.")
-
-os.makedirs(WRITE_DIR, exist_ok=True)
-
-if COLOR_MODULATION_MODE == "high_freq":
-    def encode(color_value):
-        if color_value > 0:
-            index_scalar = 15 / color_value
-            true_indices = [int(index_scalar * i) for i in range(color_value)]
-            encoded_color = [1 if (i in true_indices) else 0 for i in range(15)]
-        else:
-            encoded_color = [0] * 15
-        return encoded_color
-
-elif COLOR_MODULATION_MODE == "basic":
-    def encode(color_value):
-        encoded_color = [1 if (color_value > i) else 0 for i in range(15)]
-        return encoded_color
-
-else:
-    raise ValueError(f"'COLOR_MODULATION_MODE' should be of type 'string' with a value of either 'basic' or 'high_freq', not '{str(COLOR_MODULATION_MODE)}'.")
-
-for image_location in os.listdir(READ_DIR):
-
-    array_image_data = cv.imread(READ_DIR + '/' + image_location)
-
-    resized_image_data = cv.resize(array_image_data, (IMAGE_WIDTH, IMAGE_HEIGHT), interpolation=cv.INTER_AREA).astype(np.int64)
-
-    scaled_colors_data = (resized_image_data//15).astype(np.int8)
-   
-    y_flipped_data = np.flip(scaled_colors_data, axis=0)
-
-    half_height = IMAGE_HEIGHT // 2
-
-    top_half_data, bottom_half_data = y_flipped_data[:half_height], y_flipped_data[half_height:]
+Please go to "config.ini", located in the same directory as this file, to edit basic preferences.
 
-    combined_halves_data = np.block([top_half_data, bottom_half_data])
+The conversion itself lives in 'frame_compiler.py', which can also be imported
+or used to compile a stream of frames from stdin.
 
-    encoded_pixel_data = np.vectorize(encode, otypes=[list])(combined_halves_data)
+With REDUCED_DECODE, a JPEG much bigger than the panel is decoded at 1/2, 1/4
+or 1/8 of its size (libjpeg scales in the DCT, so the pixels it drops are
+never decoded), as small as leaves it at least as big as every target in
+both directions; the area-average resize to the panel then does the rest,
+as it does for full size images.  Each source's decode time and the size of
+the decoded image are printed; set REDUCED_DECODE = False in 'config.ini'
+to compare against full size decodes.
 
-    bin_values = np.array(encoded_pixel_data.tolist(), dtype=bool)
-    byte_values_array = np.packbits(bin_values, axis=2, bitorder='little')
-    byte_values_reshaped = np.moveaxis(byte_values_array, 3, 0)
-    raw_byte_values = byte_values_reshaped.ravel()
 
-    bytes_output = bytes(raw_byte_values)
+'''
 
-    with open(WRITE_DIR + '/' + os.path.splitext(image_location)[0] + '.bin', 'wb') as output_file:
-        output_file.write(bytes_output)
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+TARGET_SECTION = 'target '
+JPEG_REDUCTIONS = ((8, cv.IMREAD_REDUCED_COLOR_8), (4, cv.IMREAD_REDUCED_COLOR_4), (2, cv.IMREAD_REDUCED_COLOR_2))
+
+
+def read_target(read_parser, section=None):
+    # One panel to build frames for; a [target NAME] section takes anything
+    # it leaves out from the main sections
+    def get(option, main_section, get_option=read_parser.get, **fallback):
+        if section is not None and read_parser.has_option(section, option):
+            return get_option(section, option)
+        return get_option(main_section, option, **fallback)
+
+    try:
+        target = {
+            'NAME': section[len(TARGET_SECTION):].strip() if section else 'default',
+            'IMAGE_HEIGHT': get('IMAGE_HEIGHT', 'dimensions', read_parser.getint),
+            'IMAGE_WIDTH': get('IMAGE_WIDTH', 'dimensions', read_parser.getint),
+            'PIXEL_SCALE': get('PIXEL_SCALE', 'dimensions', read_parser.getint, fallback=1),
+            'COLOR_MODULATION_MODE': get('COLOR_MODULATION_MODE', 'misc'),
+            'SCAN_ORDER': get('SCAN_ORDER', 'misc', fallback='sequential'),
+            'SKIP_DARK_ROWS': get('SKIP_DARK_ROWS', 'misc', read_parser.getboolean, fallback=False),
+            'DIM_PLANES': get('DIM_PLANES', 'misc', read_parser.getint, fallback=0),
+            # Directories are relative to this script, wherever it is run from
+            'WRITE_DIR': os.path.join(SCRIPT_DIR, get('WRITE_DIR', 'files')),
+        }
+
+    except:
+        raise ImportError(f"There was an issue importing data for target '{section or 'default'}' from 'config.ini', ensure neccessary data is there and of correct type.")
+
+    if target['COLOR_MODULATION_MODE'] not in COLOR_MODULATION_MODES:
+        raise ValueError(f"'COLOR_MODULATION_MODE' should be of type 'string' with a value of either 'basic' or 'high_freq', not '{str(target['COLOR_MODULATION_MODE'])}'.")
+
+    if target['SCAN_ORDER'] not in SCAN_ORDERS:
+        raise ValueError(f"'SCAN_ORDER' should be of type 'string' with a value of {', '.join(SCAN_ORDERS)}, not '{str(target['SCAN_ORDER'])}'.")
+
+    if target['PIXEL_SCALE'] < 1 or target['IMAGE_WIDTH'] % target['PIXEL_SCALE'] or target['IMAGE_HEIGHT'] % (2 * target['PIXEL_SCALE']):
+        raise ValueError(f"'PIXEL_SCALE' should be a positive integer dividing the width and half the height of the matrix, not '{str(target['PIXEL_SCALE'])}'.")
+
+    return target
+
+
+def load_config(path=os.path.join(SCRIPT_DIR, 'config.ini')):
+    read_parser = configparser.ConfigParser()
+    read_parser.read(path)
+
+    try:
+        read_dir = os.path.join(SCRIPT_DIR, read_parser.get('files', 'READ_DIR'))
+    except:
+        raise ImportError("There was an issue importing data from 'config.ini', ensure neccessary data is there and of correct type.")
+
+    targets = [read_target(read_parser)]
+    targets += [read_target(read_parser, section) for section in read_parser.sections() if section.startswith(TARGET_SECTION)]
+
+    write_dirs = [target['WRITE_DIR'] for target in targets]
+    if len(set(write_dirs)) != len(write_dirs):
+        raise ValueError("Every target in 'config.ini' needs its own 'WRITE_DIR'.")
+
+    # The main settings stay at the top level, as they were before targets
+    config = dict(targets[0])
+    del config['NAME']
+    config['READ_DIR'] = read_dir
+    config['REDUCED_DECODE'] = read_parser.getboolean('misc', 'REDUCED_DECODE', fallback=True)
+    config['TARGETS'] = targets
+    return config
+
+
+def make_compiler(target):
+    # cv.imread gives BGR; frames are stored at the scaled down size, the Pico scales them back up.
+    # Scaled frames stay in sequential order, the Pico picks their rows out in its scan order
+    # and finds their dark rows itself
+    full_resolution = target['PIXEL_SCALE'] == 1
+    return FrameCompiler(target['IMAGE_HEIGHT'] // target['PIXEL_SCALE'], target['IMAGE_WIDTH'] // target['PIXEL_SCALE'],
+                         target['COLOR_MODULATION_MODE'], 'bgr',
+                         scan_order=target['SCAN_ORDER'] if full_resolution else 'sequential',
+                         skip_dark_rows=target['SKIP_DARK_ROWS'] and full_resolution,
+                         dim_planes=target['DIM_PLANES'])
+
+
+def jpeg_size(path):
+    # (width, height) from a JPEG's frame header, without decoding it; None
+    # for anything else
+    with open(path, 'rb') as image_file:
+        if image_file.read(2) != b'\xff\xd8':
+            return None
+        while True:
+            marker = image_file.read(2)
+            while len(marker) == 2 and marker == b'\xff\xff':
+                marker = marker[1:] + image_file.read(1)
+            if len(marker) < 2 or marker[0] != 0xFF:
+                return None
+            code = marker[1]
+            if code == 0x01 or 0xD0 <= code <= 0xD8:
+                continue
+            length = int.from_bytes(image_file.read(2), 'big')
+            # Start of frame markers, not DHT, JPG or DAC
+            if 0xC0 <= code <= 0xCF and code not in (0xC4, 0xC8, 0xCC):
+                header = image_file.read(5)
+                return int.from_bytes(header[3:5], 'big'), int.from_bytes(header[1:3], 'big')
+            if code == 0xDA or length < 2:
+                return None
+            image_file.seek(length - 2, os.SEEK_CUR)
+
+
+def decode_image(path, min_size, reduced=True):
+    # (image, reduction): a JPEG comes out as small as it can while both its
+    # sides stay at least min_size, whichever way EXIF turns it
+    size = jpeg_size(path) if reduced else None
+    if size is not None:
+        for factor, flag in JPEG_REDUCTIONS:
+            if min(size) // factor >= min_size:
+                return cv.imread(path, flag), factor
+    return cv.imread(path), 1
+
+
+def convert_directory(read_dir, targets, reduced_decode=True):
+    # targets: (compiler, write_dir) pairs.  Each image is read and decoded
+    # once, resized once per distinct size, then compiled for every target
+    for compiler, write_dir in targets:
+        os.makedirs(write_dir, exist_ok=True)
+    min_size = max(max(compiler.width, compiler.height) for compiler, write_dir in targets)
+
+    decode_time = resize_time = compile_time = 0.0
+    decoded_bytes = 0
+    converted = 0
+    for image_location in sorted(os.listdir(read_dir)):
+
+        start = time.perf_counter()
+        array_image_data, reduction = decode_image(os.path.join(read_dir, image_location), min_size, reduced_decode)
+        elapsed = time.perf_counter() - start
+        decode_time += elapsed
+
+        if array_image_data is None:
+            print(f"Skipping '{image_location}', it could not be read as an image.")
+            continue
+
+        height, width = array_image_data.shape[:2]
+        decoded_bytes = max(decoded_bytes, array_image_data.nbytes)
+        print(f"'{image_location}': decoded {width}x{height}"
+              f"{f' (1/{reduction} size)' if reduction > 1 else ''} in {1000 * elapsed:.1f}ms, "
+              f"{array_image_data.nbytes / 1e6:.2f}MB")
+
+        resized = {}
+        for compiler, write_dir in targets:
+            start = time.perf_counter()
+            size = (compiler.height, compiler.width)
+            if size not in resized:
+                resized[size] = compiler.resize(array_image_data)
+            resize_time += time.perf_counter() - start
+
+            start = time.perf_counter()
+            frame = compiler.compile_frame(resized[size])
+
+            with open(os.path.join(write_dir, os.path.splitext(image_location)[0] + '.bin'), 'wb') as output_file:
+                output_file.write(frame)
+            compile_time += time.perf_counter() - start
+        converted += 1
+
+    print(f"Converted {converted} images for {len(targets)} target(s): decoding {decode_time:.3f}s "
+          f"(largest decoded image {decoded_bytes / 1e6:.2f}MB), resizing {resize_time:.3f}s, "
+          f"compiling and writing {compile_time:.3f}s.")
+
+
+if __name__ == '__main__':
+    config = load_config()
+
+    targets = [(make_compiler(target), target['WRITE_DIR']) for target in config['TARGETS']]
+
+    convert_directory(config['READ_DIR'], targets, config['REDUCED_DECODE'])
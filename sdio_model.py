@@ -0,0 +1,450 @@
+import os
+import sys
+import types
+
+'''
+
+Host-side model of an SD card on the 4-bit SDIO bus, for checking the command
+and CRC sequencing of 'COPY_TO_PICO/lib/sdio.py' without a card or a Pico.
+
+ModelBus stands in for sdio_pio.PIOBus and hands every command frame and data
+block to CardModel, which checks framing, CRC7, CRC16 and the card state
+machine the way a real card would, and logs anything it would have rejected.
+The card side computes its CRC16s the long way, one data line at a time, so it
+does not share any code with the driver's interleaved CRC.
+
+Run this file directly to put the driver through initialisation, single and
+multi-block reads and writes, and a few injected faults.
+
+
+'''
+
+LIB_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'COPY_TO_PICO', 'lib')
+
+if 'micropython' not in sys.modules:
+    micropython_stub = types.ModuleType('micropython')
+    micropython_stub.const = lambda value: value
+    sys.modules['micropython'] = micropython_stub
+
+sys.path.insert(0, LIB_DIR)
+
+import sdio
+
+BLOCK_SIZE = 512
+MAX_INIT_FREQ = 400_000
+MAX_DATA_FREQ = 25_000_000
+
+# Card states, as numbered in the R1 CURRENT_STATE field
+IDLE, READY, IDENT, STBY, TRAN, DATA, RCV = 0, 1, 2, 3, 4, 5, 6
+
+ILLEGAL_COMMAND = 1 << 22
+COM_CRC_ERROR = 1 << 23
+ADDRESS_ERROR = 1 << 30
+READY_FOR_DATA = 1 << 8
+APP_CMD = 1 << 5
+
+
+def crc7(data):
+    crc = 0
+    for byte in data:
+        for bit in range(7, -1, -1):
+            feedback = ((crc >> 6) & 1) ^ ((byte >> bit) & 1)
+            crc = (crc << 1) & 0x7F
+            if feedback:
+                crc ^= 0x09
+    return crc
+
+
+def crc16_lane(bits):
+    crc = 0
+    for bit in bits:
+        feedback = ((crc >> 15) & 1) ^ bit
+        crc = (crc << 1) & 0xFFFF
+        if feedback:
+            crc ^= 0x1021
+    return crc
+
+
+def crc16_4bit(block):
+    # Splits the block into the four data lines, CRCs each one, and
+    # interleaves the four CRCs back the way they are clocked out.
+    nibbles = []
+    for byte in block:
+        nibbles += [byte >> 4, byte & 0xF]
+    lane_crcs = [crc16_lane([(nibble >> lane) & 1 for nibble in nibbles]) for lane in range(4)]
+    out = bytearray(8)
+    for i in range(16):
+        nibble = 0
+        for lane in range(4):
+            nibble |= ((lane_crcs[lane] >> (15 - i)) & 1) << lane
+        out[i // 2] |= nibble << (4 if i % 2 == 0 else 0)
+    return bytes(out)
+
+
+class CardModel:
+    def __init__(self, sectors=8192, high_capacity=True):
+        self.sectors = sectors
+        self.high_capacity = high_capacity
+        self.storage = bytearray(sectors * BLOCK_SIZE)
+        self.rca = 0x1234
+        self.errors = []
+        self.log = []
+        self.faults = set()
+        self.freq = 0
+        self.reset()
+
+    def reset(self):
+        self.state = IDLE
+        self.app_cmd = False
+        self.bus_width = 1
+        self.block_len = BLOCK_SIZE
+        self.status_errors = 0
+        self.acmd41_polls = 0
+        self.read_addr = None
+        self.multi_block = False
+
+    def error(self, message):
+        self.errors.append(message)
+
+    def cid(self):
+        cid = bytearray(b'\x03SDMODEL\x10\x00\x00\x00\x01\x01\x60')
+        return bytes(cid) + bytes([crc7(cid) << 1 | 1])
+
+    def csd(self):
+        if self.high_capacity:
+            c_size = self.sectors // 1024 - 1
+            csd = bytearray(15)
+            csd[0] = 0x40
+            csd[5] = 0x59
+            csd[7] = (c_size >> 16) & 0x3F
+            csd[8] = (c_size >> 8) & 0xFF
+            csd[9] = c_size & 0xFF
+        else:
+            # READ_BL_LEN 9, C_SIZE_MULT 7 (x512), C_SIZE chosen to match
+            c_size = self.sectors // 512 - 1
+            csd = bytearray(15)
+            csd[5] = 0x59
+            csd[6] = (c_size >> 10) & 0x03
+            csd[7] = (c_size >> 2) & 0xFF
+            csd[8] = (c_size & 0x03) << 6
+            csd[9] = 0x03
+            csd[10] = 0x80
+        return bytes(csd) + bytes([crc7(csd) << 1 | 1])
+
+    def status(self):
+        status = self.status_errors | (self.state << 9)
+        if self.state == TRAN:
+            status |= READY_FOR_DATA
+        if self.app_cmd:
+            status |= APP_CMD
+        return status
+
+    def r1(self, index, arg):
+        frame = bytearray([index & 0x3F, arg >> 24 & 0xFF, arg >> 16 & 0xFF, arg >> 8 & 0xFF, arg & 0xFF])
+        frame.append(crc7(frame) << 1 | 1)
+        if 'resp_crc' in self.faults:
+            self.faults.discard('resp_crc')
+            frame[5] ^= 0x02
+        return bytes(frame)
+
+    def r2(self, register):
+        return bytes([0x3F]) + register
+
+    def r3(self, ocr):
+        return bytes([0x3F, ocr >> 24 & 0xFF, ocr >> 16 & 0xFF, ocr >> 8 & 0xFF, ocr & 0xFF, 0xFF])
+
+    def command(self, frame):
+        # Returns the response frame, or None when the card stays silent
+        if len(frame) != 6 or frame[0] & 0xC0 != 0x40 or not frame[5] & 1:
+            self.error(f'bad command framing {bytes(frame).hex()}')
+            return None
+        index = frame[0] & 0x3F
+        arg = int.from_bytes(frame[1:5], 'big')
+        app = self.app_cmd
+        self.log.append(('ACMD' if app else 'CMD') + f'{index}({arg:#x})')
+
+        if crc7(frame[:5]) != frame[5] >> 1:
+            self.error(f'CMD{index}: CRC7 mismatch')
+            self.status_errors |= COM_CRC_ERROR
+            return None
+        if 'no_resp' in self.faults:
+            self.faults.discard('no_resp')
+            return None
+
+        self.app_cmd = False
+        if app:
+            return self.app_command(index, arg)
+        return self.basic_command(index, arg)
+
+    def illegal(self, name):
+        self.error(f'{name} illegal in state {self.state}')
+        self.status_errors |= ILLEGAL_COMMAND
+        return None
+
+    def basic_command(self, index, arg):
+        if index == 0:
+            self.reset()
+            return None
+
+        if self.state in (IDLE, READY, IDENT) and self.freq > MAX_INIT_FREQ:
+            self.error(f'CMD{index} sent at {self.freq} Hz during identification')
+
+        if index == 8:
+            if self.state != IDLE:
+                return self.illegal('CMD8')
+            return self.r1(8, arg & 0xFFF)
+        if index == 55:
+            if self.state not in (IDLE, STBY, TRAN) or (self.state != IDLE and arg >> 16 != self.rca):
+                return self.illegal('CMD55')
+            self.app_cmd = True
+            return self.r1(55, self.status())
+        if index == 2:
+            if self.state != READY:
+                return self.illegal('CMD2')
+            self.state = IDENT
+            return self.r2(self.cid())
+        if index == 3:
+            if self.state not in (IDENT, STBY):
+                return self.illegal('CMD3')
+            self.state = STBY
+            return self.r1(3, self.rca << 16 | (self.status() & 0x1FFF))
+        if index == 9:
+            if self.state != STBY or arg >> 16 != self.rca:
+                return self.illegal('CMD9')
+            return self.r2(self.csd())
+        if index == 7:
+            if self.state != STBY or arg >> 16 != self.rca:
+                return self.illegal('CMD7')
+            response = self.r1(7, self.status())
+            self.state = TRAN
+            return response
+        if index == 13:
+            if arg >> 16 != self.rca:
+                return None
+            response = self.r1(13, self.status())
+            self.status_errors = 0
+            return response
+        if index == 16:
+            if self.state != TRAN:
+                return self.illegal('CMD16')
+            if self.high_capacity and arg != BLOCK_SIZE:
+                self.error('CMD16: block length other than 512 on SDHC')
+            self.block_len = arg
+            return self.r1(16, self.status())
+        if index in (17, 18, 24):
+            if self.state != TRAN:
+                return self.illegal(f'CMD{index}')
+            if self.bus_width != 4:
+                self.error(f'CMD{index}: data transfer before switching to the 4-bit bus')
+            if self.freq > MAX_DATA_FREQ:
+                self.error(f'CMD{index}: clock {self.freq} Hz is over default speed')
+            block = arg if self.high_capacity else arg // BLOCK_SIZE
+            if not self.high_capacity and arg % BLOCK_SIZE:
+                self.error(f'CMD{index}: unaligned byte address on SDSC')
+            if block >= self.sectors:
+                self.status_errors |= ADDRESS_ERROR
+                return self.r1(index, self.status())
+            response = self.r1(index, self.status())
+            self.read_addr = block
+            self.multi_block = index == 18
+            self.state = RCV if index == 24 else DATA
+            return response
+        if index == 12:
+            if self.state != DATA:
+                return self.illegal('CMD12')
+            response = self.r1(12, self.status())
+            self.state = TRAN
+            return response
+        return self.illegal(f'CMD{index}')
+
+    def app_command(self, index, arg):
+        if index == 41:
+            if self.state != IDLE:
+                return self.illegal('ACMD41')
+            self.acmd41_polls += 1
+            ocr = 0x00FF8000
+            # Card reports busy for the first poll, like a real power-up
+            if self.acmd41_polls > 1:
+                ocr |= 1 << 31
+                if self.high_capacity and arg & (1 << 30):
+                    ocr |= 1 << 30
+                self.state = READY
+            return self.r3(ocr)
+        if index == 6:
+            if self.state != TRAN:
+                return self.illegal('ACMD6')
+            if arg & 3 not in (0, 2):
+                self.error('ACMD6: invalid bus width')
+            self.bus_width = 4 if arg & 3 == 2 else 1
+            return self.r1(6, self.status() | APP_CMD)
+        return self.illegal(f'ACMD{index}')
+
+    def send_block(self):
+        # Returns the next data block and its CRC, or None if not sending
+        if self.state != DATA:
+            self.error('data read with no read command outstanding')
+            return None
+        if self.read_addr >= self.sectors:
+            self.status_errors |= ADDRESS_ERROR
+            return None
+        start = self.read_addr * BLOCK_SIZE
+        data = bytes(self.storage[start:start + BLOCK_SIZE])
+        crc = crc16_4bit(data)
+        if 'data_crc' in self.faults:
+            self.faults.discard('data_crc')
+            crc = bytes([crc[0] ^ 0x10]) + crc[1:]
+        self.read_addr += 1
+        if not self.multi_block:
+            self.state = TRAN
+        return data, crc
+
+    def receive_block(self, data, crc):
+        # Returns the 3 bit CRC status token
+        if self.state != RCV:
+            self.error('data written with no write command outstanding')
+            return 0b111
+        self.state = TRAN
+        if 'write_crc' in self.faults:
+            self.faults.discard('write_crc')
+            crc = bytes([crc[0] ^ 0x01]) + bytes(crc[1:])
+        if crc16_4bit(data) != bytes(crc):
+            self.error(f'write to block {self.read_addr}: CRC16 mismatch')
+            return 0b101
+        start = self.read_addr * BLOCK_SIZE
+        self.storage[start:start + BLOCK_SIZE] = data
+        return 0b010
+
+
+class ModelBus:
+    def __init__(self, card, max_blocks=32):
+        self.card = card
+        self.max_blocks = max_blocks
+        self.crcs = bytearray(8 * max_blocks)
+        self.freq = 0
+        self.commands = 0
+        self.blocks_read = 0
+        self.blocks_written = 0
+
+    def clock(self, freq):
+        self.freq = freq
+        self.card.freq = freq
+
+    def command(self, buf, resp, resp_bits=0):
+        self.commands += 1
+        response = self.card.command(bytes(buf))
+        if resp is None:
+            if response is not None:
+                self.card.error('response to a command sent without one expected')
+            return True
+        if response is None:
+            return False
+        if len(response) * 8 != resp_bits:
+            self.card.error(f'expected a {resp_bits} bit response, card sent {len(response) * 8}')
+            return False
+        resp[:len(response)] = response
+        return True
+
+    def read(self, buf, nblocks):
+        mv = memoryview(buf)
+        for i in range(nblocks):
+            block = self.card.send_block()
+            if block is None:
+                return False
+            data, crc = block
+            mv[i * BLOCK_SIZE:(i + 1) * BLOCK_SIZE] = data
+            self.crcs[i * 8:i * 8 + 8] = crc
+            self.blocks_read += 1
+        return True
+
+    def crc(self, i):
+        return memoryview(self.crcs)[i * 8:i * 8 + 8]
+
+    def stop(self):
+        pass
+
+    def busy(self):
+        return False
+
+    def write(self, block, crc, status):
+        token = self.card.receive_block(bytes(block), bytes(crc))
+        self.blocks_written += 1
+        # What sdio_tx samples: D1-D3 pulled high, D0 idle for two clocks,
+        # then start bit, status, end bit and a short busy
+        d0 = [1, 1, 0, token >> 2 & 1, token >> 1 & 1, token & 1, 1, 0, 0, 0, 1, 1, 1, 1, 1, 1]
+        words = [0, 0]
+        for i, bit in enumerate(d0):
+            words[i // 8] = (words[i // 8] << 4) | 0xE | bit
+        status[0], status[1] = words
+        return True
+
+
+def check(label, condition, failures):
+    print(f"{'ok  ' if condition else 'FAIL'} {label}")
+    if not condition:
+        failures.append(label)
+
+
+def run(high_capacity=True):
+    failures = []
+    card = CardModel(high_capacity=high_capacity)
+    bus = ModelBus(card)
+    kind = 'SDHC' if high_capacity else 'SDSC'
+
+    pattern = bytes((i * 7 + i // 512) & 0xFF for i in range(BLOCK_SIZE * 40))
+    card.storage[BLOCK_SIZE * 100:BLOCK_SIZE * 140] = pattern
+
+    sd = sdio.SDIOCard(bus)
+    check(f'{kind}: init reaches transfer state on the 4-bit bus', card.state == TRAN and card.bus_width == 4, failures)
+    check(f'{kind}: sector count read from CSD', sd.ioctl(4, 0) == card.sectors, failures)
+    check(f'{kind}: data clock raised after init', bus.freq == MAX_DATA_FREQ, failures)
+
+    buf = bytearray(BLOCK_SIZE)
+    sd.readblocks(100, buf)
+    check(f'{kind}: single block read', buf == pattern[:BLOCK_SIZE], failures)
+
+    buf = bytearray(BLOCK_SIZE * 40)
+    sd.readblocks(100, buf)
+    check(f'{kind}: 40 block read, split over CMD18 transfers', buf == pattern, failures)
+    check(f'{kind}: card back in transfer state after CMD12', card.state == TRAN, failures)
+
+    data = bytes(range(256)) * 4
+    sd.writeblocks(7, data)
+    check(f'{kind}: two block write', card.storage[7 * BLOCK_SIZE:9 * BLOCK_SIZE] == data, failures)
+
+    card.faults.add('data_crc')
+    try:
+        sd.readblocks(100, bytearray(BLOCK_SIZE))
+        rejected = False
+    except OSError:
+        rejected = True
+    check(f'{kind}: corrupted read CRC16 rejected', rejected, failures)
+
+    card.faults.add('resp_crc')
+    try:
+        sd.readblocks(100, bytearray(BLOCK_SIZE))
+        rejected = False
+    except OSError:
+        rejected = True
+    check(f'{kind}: corrupted response CRC7 rejected', rejected, failures)
+    card.state = TRAN
+
+    card.faults.add('write_crc')
+    try:
+        sd.writeblocks(9, bytes(BLOCK_SIZE))
+        rejected = False
+    except OSError:
+        rejected = True
+    check(f'{kind}: write CRC status error reported', rejected, failures)
+
+    expected_errors = [e for e in card.errors if 'CRC16 mismatch' in e]
+    protocol_errors = [e for e in card.errors if e not in expected_errors]
+    for error in protocol_errors:
+        print(f'     card: {error}')
+    check(f'{kind}: no protocol violations seen by the card', not protocol_errors, failures)
+    print(f'     {bus.commands} commands, {bus.blocks_read} blocks read, {bus.blocks_written} blocks written')
+    return failures
+
+
+if __name__ == '__main__':
+    failures = run(high_capacity=True) + run(high_capacity=False)
+    sys.exit(1 if failures else 0)
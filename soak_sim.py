@@ -0,0 +1,714 @@
+import argparse
+import ast
+import os
+import sys
+import threading
+import types
+from collections import deque
+
+import pio_sim
+
+'''
+
+Soak test of the Pico's playback runtime ('COPY_TO_PICO/display.py') on a PC,
+for the failures that only show after hours or days: the heap running down
+to MEM_CLEAR_THRESH, the feeder thread being stopped and started again
+around each collection, the watchdog, ticks_ms wrapping (after 298 hours)
+and the image changes drifting off their schedule.
+
+display.py runs unchanged, on both of its threads, against stand-ins for
+'machine', 'utime', 'gc', '_thread', 'os' and the state machines that keep
+a virtual clock instead of the PIO simulator's ('pio_sim.py' only assembles
+the programs here).  Only one thread runs at a time, and only blocking calls
+take time: a put to led_data takes as long as the PIO takes to shift the
+bytes out (row_cycles), sleeps sleep, reading a frame takes
+FLASH_READ_RATE and gc.collect takes GC_BASE_US plus GC_US_PER_KB of heap.
+Everything else is instant, so days of playback take minutes:
+
+    python soak_sim.py [--hours 336] [--set TRANSITION='crossfade' ...] [--echo]
+
+What display.py prints is kept back, and its last OUTPUT_LINES lines shown
+with the report; --echo prints it as it comes.
+
+The heap is a model of MicroPython's, not a measurement: the frames the
+runtime reads, the row lists it makes (hub75.frame_rows, hub75.slot_views,
+transition rows) and a stack per thread are charged at their MicroPython
+sizes in 16 byte blocks, as gc.disable() leaves them until a collection
+frees whatever display.py's globals no longer reach.  An allocation that
+does not fit raises MemoryError, as it does with automatic collection off.
+Fragmentation and display.py's own small objects are not counted.
+
+_thread is the rp2 port's: one thread besides the main one, which has to
+have ended before another is started.  Locks go to the longest waiter;
+rp2's make no such promise, but a runtime that depends on it starves.
+
+The run fails on a watchdog reset or a feed later than --max-feed-gap of
+its timeout, a thread or display.py stopping, heap use above --max-heap,
+the panel being dark (enable pin high) for more than --max-dark of the
+time, or an image change more than --max-drift seconds off the CYCLE_TIME
+schedule.
+
+
+'''
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+DISPLAY_PATH = os.path.join(SCRIPT_DIR, 'COPY_TO_PICO', 'display.py')
+FRAMES_DIR = os.path.join(SCRIPT_DIR, 'COPY_TO_PICO', 'frames')
+ENABLE_PIN = 5
+
+# Heap left to a program on a Pico after MicroPython and display.py's
+# imports, modules and constants, with the stacks and file objects it adds
+HEAP_SIZE = 192 * 1024
+BOOT_HEAP = 24 * 1024
+HEAP_BLOCK = 16
+OUTPUT_LINES = 5
+THREAD_STACK = 4096
+FILE_HEAP = 320
+
+# Rough speeds of the things that take time besides the PIO
+FLASH_READ_RATE = 1_000_000
+GC_BASE_US = 1_000
+GC_US_PER_KB = 20
+
+NS = 1_000_000_000
+
+_soak = None
+
+
+class SoakOver(BaseException):
+    pass
+
+
+def _blocks(size):
+    return -(-size // HEAP_BLOCK) * HEAP_BLOCK
+
+
+def micropython_size(obj):
+    # Bytes an object takes on MicroPython's heap (32-bit, objects in whole
+    # blocks), not counting what it refers to
+    if isinstance(obj, bytes):
+        return HEAP_BLOCK + _blocks(len(obj) + 1)
+    if isinstance(obj, bytearray):
+        return HEAP_BLOCK + _blocks(len(obj))
+    if isinstance(obj, list):
+        return HEAP_BLOCK + _blocks(4 * len(obj))
+    if isinstance(obj, tuple):
+        return _blocks(8 + 4 * len(obj))
+    return HEAP_BLOCK
+
+
+def _references(obj):
+    if isinstance(obj, (list, tuple, set)):
+        return obj
+    if isinstance(obj, dict):
+        return list(obj.values())
+    if isinstance(obj, memoryview):
+        return (obj.obj,)
+    if isinstance(obj, (types.ModuleType, types.FunctionType, type, bytes, bytearray, str, int, float)):
+        return ()
+    return list(getattr(obj, '__dict__', {}).values())
+
+
+class Heap:
+    def __init__(self, size=HEAP_SIZE, boot=BOOT_HEAP):
+        self.size = size
+        self.boot = boot
+        self.objects = {}
+        self.used = boot
+        self.high_water = boot
+        self.allocated = 0
+        self.collections = 0
+        self.lowest_free_before_collect = size
+
+    def alloc(self, obj, size):
+        # Charges obj (kept until a collection finds it unreachable)
+        if self.used + size > self.size:
+            raise MemoryError('memory allocation failed, allocating %d bytes' % size)
+        self.objects[id(obj)] = (obj, size)
+        self.used += size
+        self.allocated += size
+        self.high_water = max(self.high_water, self.used)
+
+    def charge(self, obj):
+        # Charges obj and everything it holds that is not charged yet, as
+        # made by a call that returned it
+        stack = [obj]
+        while stack:
+            item = stack.pop()
+            if id(item) in self.objects or isinstance(item, (int, float, str, type(None))):
+                continue
+            if isinstance(item, memoryview) and id(item.obj) not in self.objects:
+                stack.append(item.obj)
+            self.alloc(item, micropython_size(item))
+            if isinstance(item, (list, tuple)):
+                stack.extend(item)
+        return obj
+
+    def free(self):
+        return self.size - self.used
+
+    def collect(self, roots):
+        # Keeps the charged objects roots still reach
+        self.lowest_free_before_collect = min(self.lowest_free_before_collect, self.free())
+        reached = set()
+        stack = list(roots)
+        while stack:
+            item = stack.pop()
+            if id(item) in reached:
+                continue
+            reached.add(id(item))
+            stack.extend(_references(item))
+        self.objects = {key: value for key, value in self.objects.items() if key in reached}
+        self.used = self.boot + sum(size for obj, size in self.objects.values())
+        self.collections += 1
+
+
+class Core:
+    # A thread of the runtime, run one at a time in virtual time
+    def __init__(self, name):
+        self.name = name
+        self.wake = 0
+        self.event = threading.Event()
+        self.stack = bytearray(THREAD_STACK)
+
+
+class Scheduler:
+    def __init__(self, end):
+        self.now = 0
+        self.end = end
+        self.cores = []
+        self.current = None
+        self.wdt_deadline = None
+        self.stopped = None
+        self.done = threading.Event()
+
+    def block_until(self, time):
+        core = self.current
+        core.wake = time = max(time, self.now)
+        # Most blocks end before anything else happens: no switch needed
+        if time < self.end and (self.wdt_deadline is None or time <= self.wdt_deadline) and self.stopped is None:
+            for other in self.cores:
+                if other is not core and other.wake is not None and other.wake <= time:
+                    break
+            else:
+                self.now = time
+                return
+        self._switch(core)
+
+    def block(self):
+        # Waits until another core sets this one's wake time
+        core = self.current
+        core.wake = None
+        self._switch(core)
+
+    def _next(self):
+        runnable = [core for core in self.cores if core.wake is not None]
+        core = min(runnable, key=lambda c: c.wake) if runnable else None
+        time = core.wake if core else self.end
+        if self.wdt_deadline is not None and self.wdt_deadline < min(time, self.end):
+            self.now = self.wdt_deadline
+            return self._stop('watchdog reset')
+        if time >= self.end:
+            self.now = self.end
+            return self._stop('end' if runnable or self.wdt_deadline else 'every thread stopped')
+        self.now = time
+        return core
+
+    def _switch(self, core):
+        if self.stopped is None:
+            following = self._next()
+            if following is not core and following is not None:
+                self.current = following
+                following.event.set()
+                core.event.wait()
+                core.event.clear()
+        if self.stopped is not None:
+            raise SoakOver(self.stopped)
+
+    def _stop(self, reason):
+        self.stopped = reason
+        self.done.set()
+        for core in self.cores:
+            core.event.set()
+        return None
+
+    def start(self, name, function, args=(), on_exit=None):
+        core = Core(name)
+        core.wake = self.now
+        self.cores.append(core)
+
+        def body():
+            core.event.wait()
+            core.event.clear()
+            try:
+                if self.stopped is None:
+                    function(*args)
+            except SoakOver:
+                pass
+            except BaseException as error:
+                if on_exit:
+                    on_exit(core, error)
+            self.finish(core)
+
+        thread = threading.Thread(target=body, daemon=True)
+        thread.start()
+        return core, thread
+
+    def finish(self, core):
+        self.cores.remove(core)
+        if self.stopped is None:
+            following = self._next()
+            if following is not None:
+                self.current = following
+                following.event.set()
+
+
+class Lock:
+    def __init__(self):
+        self.owner = None
+        self.waiters = deque()
+
+    def acquire(self, waitflag=1, timeout=-1):
+        scheduler = _soak.scheduler
+        if self.owner is None:
+            self.owner = scheduler.current
+            return True
+        if not waitflag:
+            return False
+        self.waiters.append(scheduler.current)
+        scheduler.block()
+        return True
+
+    def release(self):
+        if self.waiters:
+            self.owner = self.waiters.popleft()
+            self.owner.wake = _soak.scheduler.now
+        else:
+            self.owner = None
+
+    def locked(self):
+        return self.owner is not None
+
+    def __enter__(self):
+        self.acquire()
+        return self
+
+    def __exit__(self, *exc):
+        self.release()
+
+
+class StateMachine:
+    def __init__(self, id, program=None, freq=125_000_000, **kwargs):
+        self.id = id
+        self.freq = freq
+        # Set for led_data by Soak from the panel width; other machines take
+        # their words without time passing
+        self.cycles_per_byte = 0
+        self.busy_until = 0
+
+    def init(self, program=None, freq=None, **kwargs):
+        if freq is not None:
+            self.freq = freq
+
+    def active(self, value=None):
+        return 1
+
+    def restart(self):
+        pass
+
+    def exec(self, instr):
+        pass
+
+    def put(self, value, shift=0):
+        if isinstance(value, int) or not self.cycles_per_byte:
+            return
+        soak = _soak
+        now = soak.scheduler.now
+        if self.busy_until and now > self.busy_until and soak.lit:
+            soak.starved += now - self.busy_until
+        start = max(now, self.busy_until)
+        self.busy_until = start + int(len(value) * self.cycles_per_byte * NS / self.freq)
+        soak.scheduler.block_until(self.busy_until)
+
+    def get(self, buf=None, shift=0):
+        return 0
+
+    def rx_fifo(self):
+        return 0
+
+    def tx_fifo(self):
+        return 0
+
+    def irq(self, handler=None, trigger=0, hard=False):
+        pass
+
+
+class Pin:
+    IN = 0
+    OUT = 1
+    OPEN_DRAIN = 2
+    ALT = 3
+    PULL_UP = 1
+    PULL_DOWN = 2
+    IRQ_FALLING = 4
+    IRQ_RISING = 8
+
+    def __init__(self, id, mode=-1, pull=-1, *, value=None):
+        self.id = id
+        if value is not None:
+            self.value(value)
+
+    def init(self, mode=-1, pull=-1, *, value=None):
+        if value is not None:
+            self.value(value)
+
+    def value(self, value=None):
+        if value is None:
+            return _soak.pins.get(self.id, 0)
+        _soak.set_pin(self.id, 1 if value else 0)
+
+    def on(self):
+        self.value(1)
+
+    def off(self):
+        self.value(0)
+
+
+class WDT:
+    def __init__(self, id=0, timeout=5000):
+        self.timeout = timeout * 1_000_000
+        _soak.wdt_timeout = timeout / 1000
+        self.feed()
+
+    def feed(self):
+        soak = _soak
+        now = soak.scheduler.now
+        if soak.last_feed is not None:
+            soak.longest_feed_gap = max(soak.longest_feed_gap, now - soak.last_feed)
+        soak.last_feed = now
+        soak.scheduler.wdt_deadline = now + self.timeout
+
+
+class FrameFile:
+    def __init__(self, data):
+        self.data = data
+
+    def read(self, size=-1):
+        soak = _soak
+        data = self.data if size < 0 else self.data[:size]
+        soak.scheduler.block_until(soak.scheduler.now + len(data) * NS // FLASH_READ_RATE)
+        # A new object for every read, as the device allocates one
+        data = bytes(memoryview(data))
+        soak.heap.alloc(data, micropython_size(data))
+        return data
+
+    def close(self):
+        pass
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def override(source, settings):
+    # display.py's source with top level constants set to settings' values
+    tree = ast.parse(source)
+    missing = set(settings)
+    for node in tree.body:
+        if isinstance(node, ast.Assign) and len(node.targets) == 1 and isinstance(node.targets[0], ast.Name):
+            name = node.targets[0].id
+            if name in settings:
+                node.value = ast.Constant(settings[name])
+                missing.discard(name)
+    if missing:
+        raise ValueError(f'display.py has no setting {", ".join(sorted(missing))}')
+    return ast.fix_missing_locations(tree)
+
+
+class Soak:
+    def __init__(self, hours, frames_dir=FRAMES_DIR, settings=None, heap_size=HEAP_SIZE, echo=False):
+        self.scheduler = Scheduler(int(hours * 3600 * NS))
+        self.echo = echo
+        self.output = deque(maxlen=OUTPUT_LINES)
+        self.heap = Heap(heap_size)
+        self.frames = {name: open(os.path.join(frames_dir, name), 'rb').read()
+                       for name in sorted(os.listdir(frames_dir)) if name.endswith('.bin')}
+        self.settings = settings or {}
+
+        self.pins = {}
+        self.lit = False
+        self.lit_since = None
+        self.dark_since = 0
+        self.lit_time = 0
+        self.dark_events = []
+        self.starved = 0
+        self.wdt_timeout = None
+        self.last_feed = None
+        self.longest_feed_gap = 0
+        self.thread_starts = 0
+        self.errors = []
+        self.display_error = None
+        self.image_changes = []
+        self._shown = None
+        self.display = None
+
+    def set_pin(self, pin, level):
+        if self.pins.get(pin) == level:
+            return
+        self.pins[pin] = level
+        if pin == ENABLE_PIN:
+            now = self.scheduler.now
+            lit = level == 0
+            if lit and not self.lit:
+                if self.lit_since is not None:
+                    self.dark_events.append(now - self.dark_since)
+                self.lit_since = now
+            elif self.lit and not lit:
+                self.lit_time += now - self.lit_since
+                self.dark_since = now
+            self.lit = lit
+
+    def install(self):
+        global _soak
+        _soak = self
+        scheduler = self.scheduler
+
+        rp2 = types.ModuleType('rp2')
+        rp2.asm_pio = pio_sim.asm_pio
+        rp2.PIOASMError = pio_sim.PIOASMError
+        rp2.PIO = pio_sim._PIO
+        rp2.StateMachine = StateMachine
+        rp2._pio_funcs = pio_sim._pio_funcs
+
+        machine = types.ModuleType('machine')
+        machine.Pin = Pin
+        machine.WDT = WDT
+        machine.PWRON_RESET = 1
+        machine.WDT_RESET = 3
+        machine.freq = lambda hz=None: 125_000_000 if hz is None else None
+        machine.reset_cause = lambda: machine.PWRON_RESET
+
+        micropython = types.ModuleType('micropython')
+        micropython.const = pio_sim._const
+        micropython.native = micropython.viper = pio_sim._decorator
+
+        def ticks(scale):
+            return lambda: (scheduler.now * scale // NS) & pio_sim._TICKS_MASK
+
+        utime = types.ModuleType('utime')
+        utime.ticks_ms = ticks(1_000)
+        utime.ticks_us = ticks(1_000_000)
+        utime.ticks_diff = pio_sim._ticks_diff
+        utime.ticks_add = lambda ticks, delta: (ticks + delta) & pio_sim._TICKS_MASK
+        utime.sleep = lambda seconds: scheduler.block_until(scheduler.now + int(seconds * NS))
+        utime.sleep_ms = lambda ms: scheduler.block_until(scheduler.now + int(ms * 1_000_000))
+        utime.sleep_us = lambda us: scheduler.block_until(scheduler.now + int(us * 1_000))
+
+        gc = types.ModuleType('gc')
+        gc.enable = gc.disable = lambda: None
+        gc.collect = self.collect
+        gc.mem_free = self.heap.free
+        gc.mem_alloc = lambda: self.heap.used
+
+        thread = types.ModuleType('_thread')
+        thread.allocate_lock = Lock
+        thread.get_ident = threading.get_ident
+        thread.start_new_thread = self.start_thread
+
+        os_module = types.ModuleType('os')
+        os_module.listdir = lambda path='': list(self.frames) if path.strip('/') == 'frames' else ['frames', 'lib']
+
+        sys.modules.update(rp2=rp2, machine=machine, micropython=micropython, utime=utime, gc=gc, _thread=thread)
+        self.os = os_module
+        if pio_sim.LIB_DIR not in sys.path:
+            sys.path.insert(0, pio_sim.LIB_DIR)
+
+        # The calls that build what the runtime keeps, charged to the heap
+        import hub75
+        import transition
+        for name in ('frame_rows', 'slot_views', 'dark_row_groups'):
+            setattr(hub75, name, self._charged(getattr(hub75, name)))
+        transition.Transition.rows = self._charged(transition.Transition.rows)
+
+        init_state_machines = hub75.init_state_machines
+        put_frame = hub75.put_frame
+
+        def init_and_time(freq, width, address_count, pixel_scale=1, *args, **kwargs):
+            led_data_sm, address_counter_sm = init_state_machines(freq, width, address_count, pixel_scale,
+                                                                  *args, **kwargs)
+            led_data_sm.cycles_per_byte = hub75.row_cycles(width, pixel_scale, kwargs.get('timing')) / (width // pixel_scale)
+            return led_data_sm, address_counter_sm
+
+        def put_and_watch(led_data_sm, frame, rows, address_counter_sm=None):
+            # A frame reaches the panel when the feeder first sends it
+            if frame is not self._shown:
+                self._shown = frame
+                self.image_changes.append(scheduler.now)
+            put_frame(led_data_sm, frame, rows, address_counter_sm)
+
+        hub75.init_state_machines = init_and_time
+        hub75.put_frame = put_and_watch
+
+    def _charged(self, function):
+        def charged(*args, **kwargs):
+            result = function(*args, **kwargs)
+            return result if result is None else self.heap.charge(result)
+        return charged
+
+    def collect(self):
+        display = self.display
+        roots = [value for name, value in display.__dict__.items() if name != '__builtins__']
+        roots += [core.stack for core in self.scheduler.cores]
+        self.heap.collect(roots)
+        self.scheduler.block_until(self.scheduler.now + (GC_BASE_US + GC_US_PER_KB * self.heap.used // 1024) * 1_000)
+
+    def open(self, path, mode='r'):
+        frame_file = FrameFile(self.frames[path.rsplit('/', 1)[-1]])
+        self.heap.alloc(frame_file, FILE_HEAP)
+        return frame_file
+
+    def print(self, *args, **kwargs):
+        if self.echo:
+            print(*args, **kwargs)
+        else:
+            self.output.append(' '.join(map(str, args)))
+
+    def start_thread(self, function, args):
+        scheduler = self.scheduler
+        if len(scheduler.cores) > 1:
+            raise OSError(16, 'core1 in use')
+        self.thread_starts += 1
+
+        def died(core, error):
+            self.errors.append((scheduler.now, f'{core.name} thread: {type(error).__name__}: {error}'))
+
+        core, thread = scheduler.start('core1', function, args, died)
+        self.heap.alloc(core.stack, THREAD_STACK)
+
+    def run(self):
+        self.install()
+        with open(DISPLAY_PATH) as source:
+            code = compile(override(source.read(), self.settings), DISPLAY_PATH, 'exec')
+        display = self.display = types.ModuleType('display')
+        sys.modules['display'] = display
+
+        # display.py gets the Pico's filesystem in place of the PC's
+        host_import = __builtins__.__import__ if isinstance(__builtins__, types.ModuleType) else __builtins__['__import__']
+
+        def device_import(name, *args, **kwargs):
+            return self.os if name == 'os' else host_import(name, *args, **kwargs)
+
+        builtins = dict(vars(sys.modules['builtins']), __import__=device_import,
+                        open=self.open, print=self.print)
+        display.__dict__.update(__file__=DISPLAY_PATH, __builtins__=builtins)
+
+        def stopped(core, error):
+            self.display_error = (self.scheduler.now, f'{type(error).__name__}: {error}')
+
+        scheduler = self.scheduler
+        def main_thread():
+            exec(code, display.__dict__)
+            self.display_error = (scheduler.now, 'its main loop ended')
+
+        core, thread = scheduler.start('core0', main_thread, on_exit=stopped)
+        scheduler.current = core
+        core.event.set()
+        scheduler.done.wait()
+        for thread in threading.enumerate():
+            if thread.daemon:
+                thread.join(1)
+        if self.lit:
+            self.lit_time += scheduler.now - self.lit_since
+        return scheduler.stopped
+
+
+def hours(ns):
+    return ns / NS / 3600
+
+
+def check(label, condition, failures):
+    print(f"{'ok  ' if condition else 'FAIL'} {label}")
+    if not condition:
+        failures.append(label)
+
+
+def report(soak, reason, max_heap, max_dark, max_drift, max_feed_gap):
+    failures = []
+    scheduler = soak.scheduler
+    heap = soak.heap
+    elapsed = scheduler.now
+    display = soak.display
+    cycle = display.__dict__.get('CYCLE_TIME', 0)
+
+    print(f'     {hours(elapsed):.2f} h simulated, {len(soak.image_changes)} image changes, stopped: {reason}')
+    for line in soak.output:
+        print(f'     display.py: {line}')
+    print(f'     heap: high water {heap.high_water} of {heap.size} bytes ({100 * heap.high_water / heap.size:.1f}%), '
+          f'{heap.collections} collections, lowest free before one {heap.lowest_free_before_collect}')
+    rate = heap.allocated / max(1, elapsed) * NS
+    per_change = heap.allocated / max(1, len(soak.image_changes))
+    print(f'     allocation: {rate:.0f} bytes/s, {per_change:.0f} bytes per image change')
+    dark = sum(soak.dark_events)
+    print(f'     blanking: {len(soak.dark_events)} events ({len(soak.dark_events) / max(hours(elapsed), 1e-9):.1f}/h), '
+          f'longest {max(soak.dark_events, default=0) / 1e6:.2f} ms, dark {100 * (elapsed - soak.lit_time) / max(1, elapsed):.3f}% '
+          f'of the time; feeder {soak.thread_starts} starts; led_data starved for {soak.starved / NS:.3f} s while lit')
+    if soak.wdt_timeout:
+        print(f'     watchdog: longest gap between feeds {soak.longest_feed_gap / NS:.2f} s of {soak.wdt_timeout:g} s')
+
+    changes = soak.image_changes
+    drift = [changes[k] - changes[1] - (k - 1) * cycle * NS for k in range(1, len(changes))]
+    if drift:
+        print(f'     drift from the CYCLE_TIME schedule: {drift[-1] / NS:+.3f} s at the end, '
+              f'{max(map(abs, drift)) / NS:.3f} s at most, {drift[-1] / NS / max(hours(elapsed), 1e-9):+.3f} s/h')
+
+    for time, error in soak.errors:
+        print(f'     {hours(time):.2f} h: {error}')
+    if soak.display_error:
+        print(f'     {hours(soak.display_error[0]):.2f} h: display.py stopped: {soak.display_error[1]}')
+
+    check('no watchdog reset', reason != 'watchdog reset', failures)
+    check('display.py and its feeder keep running', reason == 'end' and not soak.errors and not soak.display_error,
+          failures)
+    check(f'the watchdog is fed within {100 * max_feed_gap:g}% of its timeout',
+          soak.wdt_timeout and soak.longest_feed_gap <= max_feed_gap * soak.wdt_timeout * NS, failures)
+    check(f'heap use stays under {100 * max_heap:g}%', heap.high_water <= max_heap * heap.size, failures)
+    check(f'the panel is dark under {100 * max_dark:g}% of the time',
+          elapsed - soak.lit_time <= max_dark * elapsed and soak.lit_since is not None, failures)
+    check(f'image changes stay within {max_drift:g} s of the schedule',
+          len(changes) > 1 and max(map(abs, drift)) <= max_drift * NS, failures)
+    print(f'{len(failures)} failed' if failures else 'all passed')
+    return 1 if failures else 0
+
+
+def setting(text):
+    name, _, value = text.partition('=')
+    try:
+        return name.strip(), ast.literal_eval(value.strip())
+    except (ValueError, SyntaxError):
+        raise argparse.ArgumentTypeError(f'{text!r} should be NAME=python literal')
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Run display.py for hours of virtual time against fake hardware.')
+    parser.add_argument('--hours', type=float, default=336, help='virtual hours to run for')
+    parser.add_argument('--frames', default=FRAMES_DIR, help="directory of frames to play (the Pico's 'frames')")
+    parser.add_argument('--set', type=setting, action='append', default=[], metavar='NAME=VALUE',
+                        help="override a setting at the top of display.py, e.g. TRANSITION='fade'")
+    parser.add_argument('--heap', type=int, default=HEAP_SIZE, help='heap size in bytes')
+    parser.add_argument('--max-heap', type=float, default=0.95, help='fail above this fraction of the heap')
+    parser.add_argument('--max-dark', type=float, default=0.01, help='fail if dark for more of the time')
+    parser.add_argument('--max-feed-gap', type=float, default=0.8,
+                        help='fail if the watchdog goes unfed for more of its timeout')
+    parser.add_argument('--max-drift', type=float, default=5, help='fail if an image change is further off, in s')
+    parser.add_argument('--echo', action='store_true', help="print display.py's output as it comes")
+    args = parser.parse_args(argv)
+
+    soak = Soak(args.hours, args.frames, dict(args.set), args.heap, args.echo)
+    reason = soak.run()
+    return report(soak, reason, args.max_heap, args.max_dark, args.max_drift, args.max_feed_gap)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,129 @@
+import argparse
+import json
+import sys
+import time
+
+'''
+
+Turns the event trace the Pico prints ('COPY_TO_PICO/lib/tracebuf.py', with
+TRACE = True in 'display.py') into Chrome trace JSON, which chrome://tracing
+and https://ui.perfetto.dev show as a timeline with a track for each core:
+
+    python trace_export.py capture.txt [-o trace.json]
+    python trace_export.py --port /dev/ttyACM0 [-o trace.json]
+
+capture.txt is the serial output saved after sending 'd' to the Pico; the
+last complete dump in it is used.  With --port (which needs pyserial) the
+'d' is sent and the dump read straight from the port; display.py answers at
+its next image change.
+
+Ticks wrap every 2^30 us (about 18 minutes), so each core's events are
+unwrapped back from the time of the dump, which holds as long as no two
+events in a row are further apart than that.  Times start at the oldest
+event.  The end of a span whose start was overwritten in the ring is left
+out.
+
+
+'''
+
+TICKS_PERIOD = 1 << 30
+
+# What the argument of an event means, where it has one
+ARG_NAMES = {'gc': 'free kB', 'publish': 'step', 'swap': 'planes', 'frame_in': 'planes'}
+
+
+def parse_dump(lines):
+    # The last complete dump: (ticks_us at the dump, {core: [(ticks, name,
+    # phase, arg), ...] oldest first})
+    dump = current = None
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 4 and fields[0] == 'trace':
+            current = (int(fields[3]), {core: [] for core in range(int(fields[1]))})
+        elif fields == ['trace', 'end'] and current is not None:
+            dump, current = current, None
+        elif current is not None and len(fields) == 5:
+            core, ticks, name, phase, arg = fields
+            current[1][int(core)].append((int(ticks), name, phase, int(arg)))
+    if dump is None:
+        raise ValueError('no complete trace dump found')
+    return dump
+
+
+def chrome_trace(now, events):
+    timed = []
+    for core, core_events in events.items():
+        age = 0
+        later = now
+        for order, (ticks, name, phase, arg) in enumerate(reversed(core_events)):
+            age += (later - ticks) % TICKS_PERIOD
+            later = ticks
+            timed.append((-age, -order, core, name, phase, arg))
+    if not timed:
+        return {'traceEvents': []}
+    first = min(timed)[0]
+
+    trace_events = [{'name': 'thread_name', 'ph': 'M', 'pid': 0, 'tid': core, 'args': {'name': f'core {core}'}}
+                    for core in events]
+    trace_events.append({'name': 'process_name', 'ph': 'M', 'pid': 0, 'args': {'name': 'Pico'}})
+    open_spans = {}
+    for t, _, core, name, phase, arg in sorted(timed):
+        key = (core, name)
+        if phase == 'E':
+            if not open_spans.get(key):
+                continue
+            open_spans[key] -= 1
+        elif phase == 'B':
+            open_spans[key] = open_spans.get(key, 0) + 1
+        event = {'name': name.replace('_', ' '), 'ph': phase, 'ts': t - first, 'pid': 0, 'tid': core}
+        if phase == 'i':
+            event['s'] = 't'
+        if arg and name in ARG_NAMES:
+            event['args'] = {ARG_NAMES[name]: arg}
+        trace_events.append(event)
+    return {'traceEvents': trace_events, 'displayTimeUnit': 'ms'}
+
+
+def read_port(port, wait):
+    import serial
+    lines = []
+    with serial.Serial(port, 115200, timeout=1) as link:
+        link.reset_input_buffer()
+        link.write(b'd')
+        end = time.monotonic() + wait
+        while time.monotonic() < end:
+            line = link.readline().decode(errors='replace').strip()
+            if line:
+                lines.append(line)
+            if line == 'trace end':
+                return lines
+    raise TimeoutError(f'no trace dump from {port} in {wait:g} s (is TRACE set in display.py?)')
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Convert a Pico event trace dump to Chrome trace JSON.')
+    parser.add_argument('capture', nargs='?', help='serial output holding a dump')
+    parser.add_argument('--port', help='read the dump from this serial port instead')
+    parser.add_argument('--wait', type=float, default=30, help='seconds to wait for the dump on --port')
+    parser.add_argument('-o', '--output', default='trace.json')
+    args = parser.parse_args(argv)
+    if args.port:
+        lines = read_port(args.port, args.wait)
+    elif args.capture:
+        with open(args.capture) as capture:
+            lines = capture.read().splitlines()
+    else:
+        parser.error('give a capture file or --port')
+
+    now, events = parse_dump(lines)
+    trace = chrome_trace(now, events)
+    with open(args.output, 'w') as output:
+        json.dump(trace, output)
+    timed = [event for event in trace['traceEvents'] if event['ph'] != 'M']
+    span = max((event['ts'] for event in timed), default=0)
+    print(f'{len(timed)} events over {span / 1000:.1f} ms from {len(events)} cores written to {args.output}')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,184 @@
+import argparse
+import configparser
+import json
+import os
+import sys
+import numpy as np
+import cv2 as cv
+
+from png_to_frame import SCRIPT_DIR, load_config, make_compiler, decode_image
+
+'''
+
+Compiles a zone layout ('zones.ini') for the Pico's ZONE_LAYOUT (see
+'COPY_TO_PICO/lib/zones.py'): the panel split into rectangular zones, each
+showing the images in its own READ_DIR in turn, one every INTERVAL seconds.
+
+    python zone_compiler.py [zones.ini]
+
+The panel comes from the main sections of 'config.ini'.  Which bytes and
+bits of a frame show a zone is found by compiling a frame that is white in
+the zone and black elsewhere, so it holds for every SCAN_ORDER, PIXEL_SCALE
+and DIM_PLANES; SKIP_DARK_ROWS frames move their rows about with their
+content, so zones cannot be used with it.  Every image of a zone is resized
+to the zone, compiled in place on a panel sized frame and cut down to the
+zone's bytes, its patch.
+
+WRITE_DIR gets 'layout.json' and a directory of patches per zone; copy it
+to the Pico as '/zones' and set ZONE_LAYOUT = '/zones/layout.json' in
+'display.py'.  What the Pico reads an hour is printed for each zone, next
+to replacing the whole frame at the fastest zone's interval.
+
+
+'''
+
+ZONE_SECTION = 'zone '
+LAYOUT_NAME = 'layout.json'
+
+
+def read_layout(path, config):
+    read_parser = configparser.ConfigParser()
+    if not read_parser.read(path):
+        raise FileNotFoundError(f"No zone layout at '{path}'.")
+
+    zones = []
+    try:
+        write_dir = os.path.join(SCRIPT_DIR, read_parser.get('layout', 'WRITE_DIR', fallback='zones'))
+        for section in read_parser.sections():
+            if not section.startswith(ZONE_SECTION):
+                continue
+            zones.append({
+                'NAME': section[len(ZONE_SECTION):].strip(),
+                'X': read_parser.getint(section, 'X'),
+                'Y': read_parser.getint(section, 'Y'),
+                'WIDTH': read_parser.getint(section, 'WIDTH'),
+                'HEIGHT': read_parser.getint(section, 'HEIGHT'),
+                'READ_DIR': os.path.join(SCRIPT_DIR, read_parser.get(section, 'READ_DIR')),
+                'INTERVAL': read_parser.getfloat(section, 'INTERVAL', fallback=0),
+            })
+    except:
+        raise ImportError(f"There was an issue importing the zone layout from '{path}', ensure neccessary data is there and of correct type.")
+
+    if not zones:
+        raise ValueError(f"'{path}' has no [zone NAME] sections.")
+
+    scale = config['PIXEL_SCALE']
+    for zone in zones:
+        name = zone['NAME']
+        if not name or '/' in name or len([other for other in zones if other['NAME'] == name]) > 1:
+            raise ValueError(f"Every zone needs a name of its own that can be a directory, not '{name}'.")
+        if zone['WIDTH'] < 1 or zone['HEIGHT'] < 1 or zone['X'] < 0 or zone['Y'] < 0 \
+                or zone['X'] + zone['WIDTH'] > config['IMAGE_WIDTH'] or zone['Y'] + zone['HEIGHT'] > config['IMAGE_HEIGHT']:
+            raise ValueError(f"Zone '{name}' should lie within the {config['IMAGE_WIDTH']}x{config['IMAGE_HEIGHT']} panel.")
+        if any(zone[key] % scale for key in ('X', 'Y', 'WIDTH', 'HEIGHT')):
+            raise ValueError(f"Zone '{name}' should have X, Y, WIDTH and HEIGHT in multiples of PIXEL_SCALE ({scale}).")
+        if zone['INTERVAL'] < 0:
+            raise ValueError(f"Zone '{name}' should have an INTERVAL of 0 or more seconds.")
+    return write_dir, zones
+
+
+def zone_owner(compiler, zone, scale=1):
+    # The bits of each frame byte that show the zone: a frame of the zone
+    # in white, which lights every plane of every channel
+    image = np.zeros((compiler.height, compiler.width, 3), dtype=np.uint8)
+    x, y = zone['X'] // scale, zone['Y'] // scale
+    image[y:y + zone['HEIGHT'] // scale, x:x + zone['WIDTH'] // scale] = 255
+    return np.frombuffer(bytes(compiler.compile_frame(image)), dtype=np.uint8)
+
+
+def zone_runs(owner):
+    # (start, count, keep) for every stretch of bytes the zone owns the same
+    # bits of; keep is the bits left as they were
+    change = np.flatnonzero(np.diff(owner.astype(np.int16))) + 1
+    starts = np.concatenate(([0], change))
+    ends = np.concatenate((change, [owner.size]))
+    return [(int(start), int(end - start), 0x3F ^ int(owner[start])) for start, end in zip(starts, ends) if owner[start]]
+
+
+def zone_patch(compiler, image, zone, owner, scale=1):
+    # The zone's bytes of a frame with image in the zone
+    width, height = zone['WIDTH'] // scale, zone['HEIGHT'] // scale
+    canvas = np.zeros((compiler.height, compiler.width, 3), dtype=np.uint8)
+    x, y = zone['X'] // scale, zone['Y'] // scale
+    canvas[y:y + height, x:x + width] = cv.resize(image, (width, height), interpolation=cv.INTER_AREA)
+    frame = np.frombuffer(compiler.compile_frame(canvas), dtype=np.uint8)
+    owned = owner != 0
+    return (frame[owned] & owner[owned]).tobytes()
+
+
+def compile_layout(config, write_dir, zones):
+    target = config['TARGETS'][0]
+    if target['SKIP_DARK_ROWS']:
+        raise ValueError("Zones need SKIP_DARK_ROWS = False in 'config.ini', frames that skip dark rows move their rows about.")
+    compiler = make_compiler(target)
+    scale = target['PIXEL_SCALE']
+
+    owners = [zone_owner(compiler, zone, scale) for zone in zones]
+    for i, zone in enumerate(zones):
+        for other, owner in zip(zones[:i], owners[:i]):
+            if (owners[i] & owner).any():
+                raise ValueError(f"Zones '{other['NAME']}' and '{zone['NAME']}' overlap.")
+
+    layout = {'frame_size': compiler.frame_size, 'zones': []}
+    for zone, owner in zip(zones, owners):
+        name = zone['NAME']
+        os.makedirs(os.path.join(write_dir, name), exist_ok=True)
+        patches = []
+        min_size = max(zone['WIDTH'], zone['HEIGHT']) // scale
+        for image_location in sorted(os.listdir(zone['READ_DIR'])):
+            image, reduction = decode_image(os.path.join(zone['READ_DIR'], image_location), min_size,
+                                            config['REDUCED_DECODE'])
+            if image is None:
+                print(f"Skipping '{image_location}', it could not be read as an image.")
+                continue
+            patch_name = f'{name}/{os.path.splitext(image_location)[0]}.bin'
+            with open(os.path.join(write_dir, patch_name), 'wb') as output_file:
+                output_file.write(zone_patch(compiler, image, zone, owner, scale))
+            patches.append(patch_name)
+            # A zone that never changes only shows its first image
+            if not zone['INTERVAL']:
+                break
+        if not patches:
+            raise ValueError(f"Zone '{name}' has no images in '{zone['READ_DIR']}'.")
+        runs = zone_runs(owner)
+        layout['zones'].append({'name': name, 'interval': round(zone['INTERVAL'] * 1000),
+                                'runs': [value for run in runs for value in run], 'patches': patches})
+        zone['PATCH_SIZE'] = sum(count for start, count, keep in runs)
+        zone['PATCHES'] = len(patches)
+
+    with open(os.path.join(write_dir, LAYOUT_NAME), 'w') as layout_file:
+        json.dump(layout, layout_file)
+    return layout
+
+
+def hourly_reads(zones, frame_size):
+    # Bytes a zone reads an hour, and a whole frame at the fastest interval
+    reads = {zone['NAME']: (zone['PATCH_SIZE'] * 3600 / zone['INTERVAL'] if zone['INTERVAL'] else 0) for zone in zones}
+    intervals = [zone['INTERVAL'] for zone in zones if zone['INTERVAL']]
+    return reads, (frame_size * 3600 / min(intervals) if intervals else 0)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Compile a zone layout for the Pico.')
+    parser.add_argument('layout', nargs='?', default=os.path.join(SCRIPT_DIR, 'zones.ini'))
+    args = parser.parse_args(argv)
+
+    config = load_config()
+    write_dir, zones = read_layout(args.layout, config)
+    layout = compile_layout(config, write_dir, zones)
+
+    reads, whole = hourly_reads(zones, layout['frame_size'])
+    for zone in zones:
+        every = f"every {zone['INTERVAL']:g}s" if zone['INTERVAL'] else 'once'
+        print(f"Zone '{zone['NAME']}': {zone['WIDTH']}x{zone['HEIGHT']} at ({zone['X']}, {zone['Y']}), "
+              f"{zone['PATCHES']} patch(es) of {zone['PATCH_SIZE']} bytes, shown {every}, "
+              f"{reads[zone['NAME']] / 1024:.0f} KiB/h")
+    total = sum(reads.values())
+    print(f"Wrote {os.path.join(write_dir, LAYOUT_NAME)}: {total / 1024:.0f} KiB/h read, against "
+          f"{whole / 1024:.0f} KiB/h for whole {layout['frame_size']} byte frames"
+          f"{f' ({whole / total:.1f}x more)' if total else ''}.")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())